@@ -0,0 +1,543 @@
+#include "NUMAExecutorGroup.h"
+#include "parallel.h"
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Micro- and macro-benchmarks of the scheduler, sync primitives, memory
+// pools and node-local bandwidth, next to malloc / std::thread baselines.
+//
+// Every result is printed as one JSON object per line:
+//   {"bench":"spawn","metric":"ns_per_task","value":312.5,"unit":"ns"}
+// so runs can be diffed and checked for regressions by script.
+//
+// usage: bench [name...]  runs only the benchmarks whose name contains one
+// of the arguments. BENCH_SCALE=n multiplies the iteration counts.
+
+namespace {
+
+typedef std::chrono::steady_clock clock_type;
+
+long s_scale = 1;
+
+long iterations(long n) {
+	return n * s_scale;
+}
+
+double secondsSince(clock_type::time_point start) {
+	return std::chrono::duration<double>(clock_type::now() - start).count();
+}
+
+void report(const std::string& bench, const char* metric, double value, const char* unit) {
+	printf("{\"bench\":\"%s\",\"metric\":\"%s\",\"value\":%.6g,\"unit\":\"%s\"}\n", bench.c_str(), metric, value, unit);
+	fflush(stdout);
+}
+
+struct Node {
+	int node;
+	KAFFINITY cpus;
+};
+
+// nodes with CPUs, each with its first 64 CPUs as an affinity mask
+std::vector<Node> topology() {
+	std::vector<Node> nodes;
+#ifdef _WIN32
+	ULONG highest = 0;
+	::GetNumaHighestNodeNumber(&highest);
+	for (ULONG n = 0; n <= highest; n++) {
+		ULONGLONG mask = 0;
+		if (::GetNumaNodeProcessorMask(UCHAR(n), &mask) && mask) {
+			Node node = { int(n), KAFFINITY(mask) };
+			nodes.push_back(node);
+		}
+	}
+#else
+	if (numa_available() >= 0) {
+		struct bitmask* cpus = numa_allocate_cpumask();
+		for (int n = 0; n <= numa_max_node(); n++) {
+			if (numa_node_to_cpus(n, cpus) != 0) {
+				continue;
+			}
+			KAFFINITY mask = 0;
+			for (unsigned int c = 0; c < 64 && c < cpus->size; c++) {
+				if (numa_bitmask_isbitset(cpus, c)) {
+					mask |= KAFFINITY(1) << c;
+				}
+			}
+			if (mask) {
+				Node node = { n, mask };
+				nodes.push_back(node);
+			}
+		}
+		numa_free_cpumask(cpus);
+	}
+#endif
+	if (nodes.empty()) {
+		Node node = { 0, KAFFINITY(1) };
+		nodes.push_back(node);
+	}
+	return nodes;
+}
+
+int cpuCount(KAFFINITY mask) {
+	int n = 0;
+	for (; mask; mask &= mask - 1) {
+		n++;
+	}
+	return n;
+}
+
+KAFFINITY firstCpu(KAFFINITY mask) {
+	return mask & (~mask + 1);
+}
+
+// runs f() as a task of pool and waits for it from outside
+template<class F>
+void runIn(Task::Pool& pool, F f) {
+	Task::sys::Semaphore done;
+	pool.addTask([&] {
+		f();
+		done.up();
+	});
+	done.down();
+}
+
+void spin(int n) {
+	volatile int x = 0;
+	for (int i = 0; i < n; i++) {
+		x = x + i;
+	}
+}
+
+void reportQueueWait(const std::string& bench, const Task::Pool& pool) {
+	Task::PoolMetrics m;
+	pool.metrics(m);
+	report(bench, "queue_wait_p50", m.total.queueWait.percentile(0.5), "ns");
+	report(bench, "queue_wait_p99", m.total.queueWait.percentile(0.99), "ns");
+}
+
+// coroutine yield round trip against a thread ping-pong
+void benchSwitch(const std::vector<Node>& nodes) {
+	const long n = iterations(200000);
+	{
+		Task::Pool pool(1, firstCpu(nodes[0].cpus));
+		double secs = 0;
+		runIn(pool, [&] {
+			coroutine* self = Task::Pool::getRunningTask();
+			clock_type::time_point start = clock_type::now();
+			for (long i = 0; i < n; i++) {
+				self->yield();
+			}
+			secs = secondsSince(start);
+		});
+		report("switch", "ns_per_yield", secs * 1e9 / n, "ns");
+	}
+	{
+		const long rounds = n / 10;
+		Task::sys::Semaphore ping, pong;
+		std::thread peer([&] {
+			for (long i = 0; i < rounds; i++) {
+				ping.down();
+				pong.up();
+			}
+		});
+		clock_type::time_point start = clock_type::now();
+		for (long i = 0; i < rounds; i++) {
+			ping.up();
+			pong.down();
+		}
+		double secs = secondsSince(start);
+		peer.join();
+		report("switch.thread", "ns_per_roundtrip", secs * 1e9 / rounds, "ns");
+	}
+}
+
+struct SpawnCount {
+	std::atomic<long> left;
+	Task::sys::Semaphore done;
+	static void s_task(void* p) {
+		SpawnCount* self = reinterpret_cast<SpawnCount*>(p);
+		if (self->left.fetch_sub(1) == 1) {
+			self->done.up();
+		}
+	}
+};
+
+// empty tasks submitted from outside and from a worker, per submission kind
+void benchSpawn(const std::vector<Node>& nodes) {
+	const long n = iterations(200000);
+	int workers = cpuCount(nodes[0].cpus);
+	{
+		Task::Pool pool(workers, nodes[0].cpus);
+		SpawnCount c;
+		c.left.store(n);
+		clock_type::time_point start = clock_type::now();
+		for (long i = 0; i < n; i++) {
+			pool.addTask(SpawnCount::s_task, &c);
+		}
+		c.done.down();
+		double secs = secondsSince(start);
+		report("spawn.external", "ns_per_task", secs * 1e9 / n, "ns");
+		reportQueueWait("spawn.external", pool);
+	}
+	{
+		Task::Pool pool(workers, nodes[0].cpus);
+		SpawnCount c;
+		c.left.store(n);
+		double secs = 0;
+		runIn(pool, [&] {
+			clock_type::time_point start = clock_type::now();
+			for (long i = 0; i < n; i++) {
+				pool.addTask(SpawnCount::s_task, &c);
+			}
+			// blocking on c.done would hold up the worker
+			while (c.left.load()) {
+				Task::Pool::getRunningTask()->yield();
+			}
+			secs = secondsSince(start);
+		});
+		report("spawn.worker", "ns_per_task", secs * 1e9 / n, "ns");
+		reportQueueWait("spawn.worker", pool);
+	}
+	{
+		Task::Pool pool(workers, nodes[0].cpus);
+		SpawnCount c;
+		c.left.store(n);
+		clock_type::time_point start = clock_type::now();
+		for (long i = 0; i < n; i++) {
+			pool.addInlineTask(SpawnCount::s_task, &c);
+		}
+		c.done.down();
+		double secs = secondsSince(start);
+		report("spawn.inline", "ns_per_task", secs * 1e9 / n, "ns");
+		reportQueueWait("spawn.inline", pool);
+	}
+	{
+		Task::Pool pool(workers, nodes[0].cpus);
+		SpawnCount c;
+		c.left.store(n);
+		SpawnCount* cp = &c;
+		clock_type::time_point start = clock_type::now();
+		for (long i = 0; i < n; i++) {
+			pool.addTask([cp] { SpawnCount::s_task(cp); });
+		}
+		c.done.down();
+		double secs = secondsSince(start);
+		report("spawn.closure", "ns_per_task", secs * 1e9 / n, "ns");
+	}
+	{
+		const long threads = n / 100;
+		clock_type::time_point start = clock_type::now();
+		for (long i = 0; i < threads; i++) {
+			std::thread t([] {});
+			t.join();
+		}
+		double secs = secondsSince(start);
+		report("spawn.thread", "ns_per_task", secs * 1e9 / threads, "ns");
+	}
+}
+
+// a root task spawning width children and waiting for all of them
+void benchFanout(const std::vector<Node>& nodes) {
+	const int width = 64;
+	const long rounds = iterations(5000);
+	Task::Pool pool(cpuCount(nodes[0].cpus), nodes[0].cpus);
+	double secs = 0;
+	runIn(pool, [&] {
+		Task::Semaphore sem;
+		Task::Semaphore* sp = &sem;
+		clock_type::time_point start = clock_type::now();
+		for (long r = 0; r < rounds; r++) {
+			for (int i = 0; i < width; i++) {
+				pool.addTask([sp] { sp->up(); });
+			}
+			sem.down(width);
+		}
+		secs = secondsSince(start);
+	});
+	report("fanout", "rounds_per_sec", rounds / secs, "1/s");
+	report("fanout", "ns_per_child", secs * 1e9 / (rounds * width), "ns");
+}
+
+// everything queued on worker 0, the others only get work by stealing
+void benchSteal(const std::vector<Node>& nodes) {
+	const long n = iterations(100000);
+	Task::Pool pool(cpuCount(nodes[0].cpus), nodes[0].cpus);
+	SpawnCount c;
+	c.left.store(n);
+	SpawnCount* cp = &c;
+	clock_type::time_point start = clock_type::now();
+	for (long i = 0; i < n; i++) {
+		pool.addTask([cp] {
+			spin(500);
+			SpawnCount::s_task(cp);
+		}, 0);
+	}
+	c.done.down();
+	double secs = secondsSince(start);
+	Task::PoolMetrics m;
+	pool.metrics(m);
+	report("steal", "tasks_per_sec", n / secs, "1/s");
+	report("steal", "steals", double(m.total.steals), "count");
+	report("steal", "failed_steals", double(m.total.failedSteals), "count");
+}
+
+// every contender takes the lock perTask times around a shared counter
+template<class Lock>
+double contendTasks(Task::Pool& pool, Lock& lock, int tasks, long perTask) {
+	long counter = 0;
+	SpawnCount c;
+	c.left.store(tasks);
+	clock_type::time_point start = clock_type::now();
+	for (int t = 0; t < tasks; t++) {
+		pool.addTask([&] {
+			for (long i = 0; i < perTask; i++) {
+				lock.lock();
+				counter++;
+				lock.unlock();
+			}
+			SpawnCount::s_task(&c);
+		});
+	}
+	c.done.down();
+	return secondsSince(start) * 1e9 / (tasks * perTask);
+}
+
+template<class Lock>
+double contendThreads(Lock& lock, int threads, long perThread) {
+	long counter = 0;
+	std::vector<std::thread> ts;
+	clock_type::time_point start = clock_type::now();
+	for (int t = 0; t < threads; t++) {
+		ts.push_back(std::thread([&] {
+			for (long i = 0; i < perThread; i++) {
+				lock.lock();
+				counter++;
+				lock.unlock();
+			}
+		}));
+	}
+	for (size_t t = 0; t < ts.size(); t++) {
+		ts[t].join();
+	}
+	return secondsSince(start) * 1e9 / (threads * perThread);
+}
+
+struct SharedReader {
+	Task::SharedMutex& m;
+	void lock() {
+		m.lockShared();
+	}
+	void unlock() {
+		m.unlockShared();
+	}
+};
+
+void benchSync(const std::vector<Node>& nodes) {
+	const long per = iterations(20000);
+	int workers = cpuCount(nodes[0].cpus);
+	int contenders = workers * 4;
+	Task::Pool pool(workers, nodes[0].cpus);
+	{
+		Task::Mutex m;
+		report("sync.mutex", "ns_per_lock", contendTasks(pool, m, contenders, per), "ns");
+	}
+	{
+		Task::SharedMutex m;
+		report("sync.shared_mutex", "ns_per_lock", contendTasks(pool, m, contenders, per), "ns");
+		SharedReader r = { m };
+		report("sync.shared_mutex.read", "ns_per_lock", contendTasks(pool, r, contenders, per), "ns");
+	}
+	{
+		Task::sys::CohortLock m;
+		report("sync.cohort_lock", "ns_per_lock", contendThreads(m, contenders, per), "ns");
+	}
+	{
+		std::mutex m;
+		report("sync.std_mutex", "ns_per_lock", contendThreads(m, contenders, per), "ns");
+	}
+}
+
+// alloc then free batches of random sizes in [16, 1024]
+template<class Alloc, class Free>
+double churn(Alloc alloc, Free release, long ops) {
+	const int BATCH = 64;
+	void* blocks[BATCH];
+	unsigned int seed = 12345;
+	clock_type::time_point start = clock_type::now();
+	for (long done = 0; done < ops; done += BATCH) {
+		for (int i = 0; i < BATCH; i++) {
+			seed = seed * 1103515245 + 12345;
+			blocks[i] = alloc(16 + (seed >> 16) % 1009);
+		}
+		for (int i = BATCH - 1; i >= 0; i--) {
+			release(blocks[i]);
+		}
+	}
+	return secondsSince(start) * 1e9 / ops;
+}
+
+// Fills a pool with random sizes, frees every other block and then packs
+// it with 8 KB blocks until it is full: the share of the pool in use at
+// that point is what fragmentation left usable.
+double fragmentation() {
+	const unsigned int SIZE = 16 * 1024 * 1024;
+	FixedSizePool<SIZE> pool;
+	std::vector<std::pair<void*, size_t> > blocks;
+	unsigned int seed = 54321;
+	size_t held = 0;
+	for (;;) {
+		seed = seed * 1103515245 + 12345;
+		size_t size = 16 + (seed >> 16) % 4081;
+		void* p = pool.alloc(size);
+		if (!p) {
+			break;
+		}
+		blocks.push_back(std::make_pair(p, size));
+		held += size;
+	}
+	for (size_t i = 0; i < blocks.size(); i += 2) {
+		pool.free(blocks[i].first);
+		held -= blocks[i].second;
+	}
+	while (pool.alloc(8192)) {
+		held += 8192;
+	}
+	return double(held) / SIZE;
+}
+
+void benchAlloc(const std::vector<Node>& nodes) {
+	const long ops = iterations(1000000);
+	int node = nodes[0].node;
+	{
+		FixedSizePool<32 * 1024 * 1024> pool(node);
+		report("alloc.fixed", "ns_per_op", churn([&](size_t s) { return pool.alloc(s); }, [&](void* p) { pool.free(p); }, ops), "ns");
+	}
+	{
+		VariableSizePool<FixedSizePool<32 * 1024 * 1024> > pool(node);
+		report("alloc.variable", "ns_per_op", churn([&](size_t s) { return pool.alloc(s); }, [&](void* p) { pool.free(p); }, ops), "ns");
+	}
+	{
+		memPoolType pool(node);
+		report("alloc.threadsafe", "ns_per_op", churn([&](size_t s) { return pool.alloc(s); }, [&](void* p) { pool.free(p); }, ops), "ns");
+	}
+	{
+		NUMAExecutorGroup eg(node, nodes[0].cpus);
+		double ns = 0;
+		runIn(eg.taskPool(), [&] {
+			ns = churn([](size_t s) { return NUMAExecutorGroup::localAlloc(s); }, [](void* p) { NUMAExecutorGroup::localFree(p); }, ops);
+		});
+		report("alloc.local", "ns_per_op", ns, "ns");
+	}
+	report("alloc.malloc", "ns_per_op", churn([](size_t s) { return ::malloc(s); }, [](void* p) { ::free(p); }, ops), "ns");
+	report("alloc.fixed", "usable_after_fragmentation", fragmentation(), "ratio");
+}
+
+double sumBuffer(Task::Pool& pool, const double* buf, size_t count) {
+	return Task::parallel_reduce(pool, 0, count, 0.0, [buf](size_t lo, size_t hi) {
+		double s = 0;
+		for (size_t i = lo; i < hi; i++) {
+			s += buf[i];
+		}
+		return s;
+	}, [](double& acc, const double& part) {
+		acc += part;
+	});
+}
+
+// every group reads a buffer placed on every node, and one from malloc
+void benchBandwidth(const std::vector<Node>& nodes) {
+	const size_t count = 8 * 1024 * 1024;
+	const int passes = int(iterations(4));
+	std::vector<NUMAExecutorGroup*> groups;
+	std::vector<double*> bufs;
+	for (size_t i = 0; i < nodes.size(); i++) {
+		groups.push_back(new NUMAExecutorGroup(nodes[i].node, nodes[i].cpus));
+		bufs.push_back(static_cast<double*>(groups[i]->memPool()->alloc(count * sizeof(double))));
+	}
+	double* heap = static_cast<double*>(::malloc(count * sizeof(double)));
+	for (size_t i = 0; i < bufs.size(); i++) {
+		if (!bufs[i]) {
+			continue;
+		}
+		double* buf = bufs[i];
+		Task::parallel_for(groups[i]->taskPool(), 0, count, [buf](size_t lo, size_t hi) {
+			for (size_t k = lo; k < hi; k++) {
+				buf[k] = 1.0;
+			}
+		});
+	}
+	std::fill(heap, heap + count, 1.0);
+	for (size_t g = 0; g < groups.size(); g++) {
+		for (size_t b = 0; b <= bufs.size(); b++) {
+			double* buf = b < bufs.size() ? bufs[b] : heap;
+			if (!buf) {
+				continue;
+			}
+			clock_type::time_point start = clock_type::now();
+			double sum = 0;
+			for (int p = 0; p < passes; p++) {
+				sum += sumBuffer(groups[g]->taskPool(), buf, count);
+			}
+			double secs = secondsSince(start);
+			char name[64];
+			if (b < bufs.size()) {
+				snprintf(name, sizeof(name), "bandwidth.node%d.from%d", nodes[g].node, nodes[b].node);
+			} else {
+				snprintf(name, sizeof(name), "bandwidth.node%d.malloc", nodes[g].node);
+			}
+			report(name, b == g ? "local_gb_per_sec" : "gb_per_sec", passes * count * sizeof(double) / secs / 1e9, "GB/s");
+			if (sum != double(passes) * count) {
+				report(name, "checksum_error", sum, "count");
+			}
+		}
+	}
+	::free(heap);
+	for (size_t i = 0; i < groups.size(); i++) {
+		if (bufs[i]) {
+			groups[i]->memPool()->free(bufs[i]);
+		}
+		delete groups[i];
+	}
+}
+
+struct Bench {
+	const char* name;
+	void (*run)(const std::vector<Node>&);
+};
+
+const Bench s_benches[] = {
+	{ "switch", benchSwitch },
+	{ "spawn", benchSpawn },
+	{ "fanout", benchFanout },
+	{ "steal", benchSteal },
+	{ "sync", benchSync },
+	{ "alloc", benchAlloc },
+	{ "bandwidth", benchBandwidth },
+};
+
+}
+
+int main(int argc, char* argv[]) {
+	const char* scale = getenv("BENCH_SCALE");
+	if (scale && atol(scale) > 0) {
+		s_scale = atol(scale);
+	}
+	std::vector<Node> nodes = topology();
+	for (size_t i = 0; i < sizeof(s_benches) / sizeof(s_benches[0]); i++) {
+		bool selected = argc < 2;
+		for (int a = 1; a < argc && !selected; a++) {
+			selected = strstr(s_benches[i].name, argv[a]) != NULL;
+		}
+		if (selected) {
+			s_benches[i].run(nodes);
+		}
+	}
+	return 0;
+}
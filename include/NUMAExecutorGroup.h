@@ -1,11 +1,13 @@
 #pragma once
 #include "mempool.h"
 #include "taskpool.h"
+#include "blocking.h"
+#include "cohortlock.h"
 
-typedef ThreadSafePool<VariableSizePool<FixedSizePool<256*1024*1024>>, Task::sys::Mutex> memPoolType;
+typedef ThreadSafePool<VariableSizePool<FixedSizePool<256*1024*1024>>, Task::sys::CohortLock> memPoolType;
 
 class NUMAExecutorGroup;
-extern ThreadLocal<NUMAExecutorGroup*> curExecutorGroup;
+extern Task::ContextLocal<NUMAExecutorGroup*, &Task::WorkerContext::group> curExecutorGroup;
 
 class NUMAExecutorGroup
 {
@@ -26,10 +28,43 @@ public:
 	Task::Pool& taskPool() const {
 		return *m_taskPool;
 	}
+	// threads for run_blocking(), pinned to the same CPUs
+	Task::BlockingPool& blockingPool() const {
+		return *m_blockingPool;
+	}
 
 	memPoolType* memPool() const {
 		return m_memPool;
 	}
+	// the group's admission limit is its pool's, see Pool::setAdmission()
+	void setAdmission(size_t limit, Task::Pool::overload_policy_t policy = Task::Pool::OVERLOAD_REJECT) {
+		m_taskPool->setAdmission(limit, policy);
+	}
+	// for throttling upstream, see Pool::pressure()
+	double pressure() const {
+		return m_taskPool->pressure();
+	}
+	// for latency-critical groups with cores to spare, see Pool::setBusyPoll()
+	void setBusyPoll(bool on) {
+		m_taskPool->setBusyPoll(on);
+	}
+	// hardware counters of the group's workers, see Pool::setPerfCounters()
+	void setPerfCounters(bool on, bool perTask = false) {
+		m_taskPool->setPerfCounters(on, perTask);
+	}
+	void perfSnapshot(Task::PerfSnapshot& out) const {
+		m_taskPool->perfSnapshot(out);
+	}
+	void metrics(Task::PoolMetrics& out) const {
+		m_taskPool->metrics(out);
+	}
+	// allocate from the calling thread's group memPool, or the heap when the
+	// caller is not in a group. Blocks remember where they came from, so
+	// localFree() may run on any thread.
+	static void* localAlloc(size_t size);
+	static void localFree(void* p);
+	// like localAlloc() but from this group's node, whoever calls it
+	void* alloc(size_t size);
 	int m_thrCount;
 	int m_NUMANode;
 private:
@@ -37,7 +72,24 @@ private:
 	Task::Thread *m_thread;
 	memPoolType * m_memPool;
 	Task::Pool *m_taskPool;
+	Task::BlockingPool *m_blockingPool;
 
 	static void s_thread_init(void * ctx, int);
+	static void* allocFrom(memPoolType* pool, size_t size);
+};
+
+// objects deriving from this are placed in node-local memory by new/delete
+class NodeLocal {
+public:
+	static void* operator new(size_t size) {
+		void* p = NUMAExecutorGroup::localAlloc(size);
+		if (!p) {
+			throw std::bad_alloc();
+		}
+		return p;
+	}
+	static void operator delete(void* p) {
+		NUMAExecutorGroup::localFree(p);
+	}
 };
 
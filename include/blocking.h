@@ -0,0 +1,107 @@
+#ifndef _NUMA_BLOCKING_H_
+#define _NUMA_BLOCKING_H_
+#include "taskpool.h"
+#include <exception>
+#include <type_traits>
+
+namespace Task {
+	namespace detail {
+		struct BlockingJob {
+			coroutine_func_t func;
+			void* ud;
+			coroutine* co;
+		};
+	}
+
+	// Plain threads for calls that block the OS thread: sys primitives,
+	// fsync, legacy libraries. Threads are started on demand up to
+	// maxThreads and then stay around; further calls queue up.
+	class BlockingPool : public noncopyable {
+	public:
+		static const int DEFAULT_THREADS = 32;
+		BlockingPool(int maxThreads = DEFAULT_THREADS, KAFFINITY affinity = 0, Pool::thread_init_t init_func = 0, void* ctx = 0);
+		// finishes the queued calls first
+		~BlockingPool();
+		void submit(detail::BlockingJob* job);
+		int threadCount() const;
+		// used by pools outside any NUMAExecutorGroup
+		static BlockingPool& global();
+	private:
+		typedef lock_guard<sys::Mutex> scoped_lock;
+		mutable sys::Mutex m_lock;
+		sys::Semaphore m_ready;
+		std::deque<detail::BlockingJob*> m_jobs;
+		std::vector<Thread*> m_threads;
+		int m_busy;
+		bool m_Exit;
+		int m_maxThreads;
+		KAFFINITY m_affinity;
+		Pool::thread_init_t m_threadInit;
+		void* m_ctx;
+
+		void routine();
+		static void s_routine(void* p);
+	};
+
+	// Runs func(ud) on the blocking pool of the caller's node and suspends
+	// the calling coroutine until it returns; the coroutine then resumes on
+	// the worker it left. Outside a pool func simply runs inline.
+	void run_blocking(coroutine_func_t func, void* ud);
+
+	namespace detail {
+		template<class F, class R>
+		struct BlockingCall {
+			F& f;
+			typename std::aligned_storage<sizeof(R), std::alignment_of<R>::value>::type result;
+			std::exception_ptr error;
+			BlockingCall(F& func) : f(func) {}
+			static void s_run(void* p) {
+				BlockingCall* self = reinterpret_cast<BlockingCall*>(p);
+				try {
+					new (&self->result) R(self->f());
+				} catch (...) {
+					self->error = std::current_exception();
+				}
+			}
+			R take() {
+				if (error) {
+					std::rethrow_exception(error);
+				}
+				R& r = *reinterpret_cast<R*>(&result);
+				R v(std::move(r));
+				r.~R();
+				return v;
+			}
+		};
+		template<class F>
+		struct BlockingCall<F, void> {
+			F& f;
+			std::exception_ptr error;
+			BlockingCall(F& func) : f(func) {}
+			static void s_run(void* p) {
+				BlockingCall* self = reinterpret_cast<BlockingCall*>(p);
+				try {
+					self->f();
+				} catch (...) {
+					self->error = std::current_exception();
+				}
+			}
+			void take() {
+				if (error) {
+					std::rethrow_exception(error);
+				}
+			}
+		};
+	}
+
+	// f() runs on a blocking thread, its result or exception comes back to
+	// the caller
+	template<class F>
+	typename std::result_of<F()>::type run_blocking(F f) {
+		detail::BlockingCall<F, typename std::result_of<F()>::type> call(f);
+		run_blocking(call.s_run, &call);
+		return call.take();
+	}
+}
+
+#endif
@@ -0,0 +1,407 @@
+#ifndef _NUMA_CHANNEL_H_
+#define _NUMA_CHANNEL_H_
+#include "NUMAExecutorGroup.h"
+#include <atomic>
+#include <utility>
+#include <type_traits>
+#include <stdint.h>
+
+namespace Task {
+
+	// Blocking half of a channel: who waits for items or room, and close().
+	// Waiting suspends the coroutine, or blocks the thread off-pool.
+	class ChannelBase : public noncopyable {
+	public:
+		// wakes everybody; sends fail from now on, receives drain what is left
+		void close();
+		bool closed() const {
+			return m_closed.load(std::memory_order_acquire);
+		}
+		// an item is there or the channel is closed
+		virtual bool readable() const = 0;
+		// there is room or the channel is closed
+		virtual bool writable() const = 0;
+	protected:
+		ChannelBase();
+		virtual ~ChannelBase() {}
+		// may return before anything changed, callers check again
+		void waitReadable();
+		void waitWritable();
+		// call after making count items or count slots available
+		void notifyReaders(size_t count) {
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if (m_readers.waiting.load(std::memory_order_relaxed)) {
+				wake(m_readers, count);
+			}
+		}
+		void notifyWriters(size_t count) {
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if (m_writers.waiting.load(std::memory_order_relaxed)) {
+				wake(m_writers, count);
+			}
+		}
+	private:
+		struct Waiter;
+		// one per channel a waiter is queued on
+		struct waitItem : public ListHook {
+			Waiter* waiter;
+			bool queued;
+		};
+		struct WaitList {
+			IntrusiveList<waitItem> items;
+			std::atomic<int> waiting;
+			WaitList() : waiting(0) {}
+		};
+		sys::Mutex m_lock;
+		WaitList m_readers;
+		WaitList m_writers;
+		std::atomic<bool> m_closed;
+
+		void wake(WaitList& list, size_t count);
+		static void wait(ChannelBase* const* channels, int count, bool write);
+		static void s_parkWaiter(void* ctx);
+		static void enqueue(Waiter* w);
+		static void dequeue(Waiter* w);
+		friend int select(ChannelBase* const* channels, int count);
+	};
+
+	// Waits until one of the channels is readable and returns its index.
+	// Another receiver may get to the item first, so follow up with tryRecv()
+	// and select again when that fails.
+	int select(ChannelBase* const* channels, int count);
+
+	namespace detail {
+		// Bounded MPMC ring (Vyukov): every cell carries a sequence number
+		// telling producers and consumers whose turn it is, so neither side
+		// locks. Once sealed it takes no more items.
+		template<class T>
+		class ChannelRing : public NodeLocal {
+			struct Cell {
+				std::atomic<size_t> seq;
+				typename std::aligned_storage<sizeof(T), std::alignment_of<T>::value>::type value;
+			};
+		public:
+			// cells start on a cache line, one T and its sequence word each
+			static const size_t CELL_SIZE = sizeof(Cell);
+			// capacity must be a power of two. The cells go to home's node,
+			// by default the caller's.
+			explicit ChannelRing(size_t capacity, NUMAExecutorGroup* home = NULL)
+				: m_enqueuePos(0)
+				, m_dequeuePos(0)
+				, m_mask(capacity - 1)
+				, m_next(NULL)
+			{
+				assert(capacity && (capacity & (capacity - 1)) == 0);
+				size_t bytes = sizeof(Cell) * capacity + CACHE_LINE_SIZE;
+				m_mem = home ? home->alloc(bytes) : NUMAExecutorGroup::localAlloc(bytes);
+				if (!m_mem) {
+					throw std::bad_alloc();
+				}
+				m_cells = reinterpret_cast<Cell*>(MEM_ALIGN(reinterpret_cast<uintptr_t>(m_mem), CACHE_LINE_SIZE));
+				for (size_t i = 0; i < capacity; i++) {
+					new (&m_cells[i].seq) std::atomic<size_t>(i);
+				}
+			}
+			// nobody may use it any more
+			~ChannelRing() {
+				size_t end = m_enqueuePos.load(std::memory_order_relaxed) & ~SEALED;
+				for (size_t pos = m_dequeuePos.load(std::memory_order_relaxed); pos != end; pos++) {
+					reinterpret_cast<T*>(&m_cells[pos & m_mask].value)->~T();
+				}
+				NUMAExecutorGroup::localFree(m_mem);
+			}
+			size_t capacity() const {
+				return m_mask + 1;
+			}
+			// v is only moved from on success
+			template<class U>
+			bool tryPush(U&& v) {
+				size_t pos = m_enqueuePos.load(std::memory_order_relaxed);
+				for (;;) {
+					if (pos & SEALED) {
+						return false;
+					}
+					Cell& cell = m_cells[pos & m_mask];
+					intptr_t dif = intptr_t(cell.seq.load(std::memory_order_acquire)) - intptr_t(pos);
+					if (dif == 0) {
+						if (m_enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+							new (&cell.value) T(std::forward<U>(v));
+							cell.seq.store(pos + 1, std::memory_order_release);
+							return true;
+						}
+					} else if (dif < 0) {
+						return false;
+					} else {
+						pos = m_enqueuePos.load(std::memory_order_relaxed);
+					}
+				}
+			}
+			// Pushes the longest prefix of items that fits with one
+			// reservation and returns its length. Non-const items are moved from.
+			template<class U>
+			size_t tryPushBatch(U* items, size_t count) {
+				size_t pos = m_enqueuePos.load(std::memory_order_relaxed);
+				for (;;) {
+					if (pos & SEALED) {
+						return 0;
+					}
+					size_t n = 0;
+					while (n < count && n <= m_mask && m_cells[(pos + n) & m_mask].seq.load(std::memory_order_acquire) == pos + n) {
+						n++;
+					}
+					if (!n) {
+						intptr_t dif = intptr_t(m_cells[pos & m_mask].seq.load(std::memory_order_acquire)) - intptr_t(pos);
+						if (dif < 0) {
+							return 0;
+						}
+						pos = m_enqueuePos.load(std::memory_order_relaxed);
+						continue;
+					}
+					if (m_enqueuePos.compare_exchange_weak(pos, pos + n, std::memory_order_relaxed)) {
+						for (size_t i = 0; i < n; i++) {
+							Cell& cell = m_cells[(pos + i) & m_mask];
+							new (&cell.value) T(std::move(items[i]));
+							cell.seq.store(pos + i + 1, std::memory_order_release);
+						}
+						return n;
+					}
+				}
+			}
+			bool tryPop(T& out) {
+				size_t pos = m_dequeuePos.load(std::memory_order_relaxed);
+				for (;;) {
+					Cell& cell = m_cells[pos & m_mask];
+					intptr_t dif = intptr_t(cell.seq.load(std::memory_order_acquire)) - intptr_t(pos + 1);
+					if (dif == 0) {
+						if (m_dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+							T* v = reinterpret_cast<T*>(&cell.value);
+							out = std::move(*v);
+							v->~T();
+							cell.seq.store(pos + m_mask + 1, std::memory_order_release);
+							return true;
+						}
+					} else if (dif < 0) {
+						return false;
+					} else {
+						pos = m_dequeuePos.load(std::memory_order_relaxed);
+					}
+				}
+			}
+			// counts items still being written too
+			size_t size() const {
+				return (m_enqueuePos.load(std::memory_order_acquire) & ~SEALED) - m_dequeuePos.load(std::memory_order_acquire);
+			}
+			// the oldest item is published, unlike size() this skips items
+			// still being written
+			bool ready() const {
+				size_t pos = m_dequeuePos.load(std::memory_order_acquire);
+				return m_cells[pos & m_mask].seq.load(std::memory_order_acquire) == pos + 1;
+			}
+			// the next ring, once this one is sealed and empty
+			ChannelRing* drainedNext() const {
+				size_t pos = m_enqueuePos.load(std::memory_order_acquire);
+				if (!(pos & SEALED) || (pos & ~SEALED) != m_dequeuePos.load(std::memory_order_acquire)) {
+					return NULL;
+				}
+				return next();
+			}
+			// pushes in progress still land, later ones fail
+			void seal(ChannelRing* next) {
+				m_next.store(next, std::memory_order_release);
+				m_enqueuePos.fetch_or(SEALED, std::memory_order_acq_rel);
+			}
+			ChannelRing* next() const {
+				return m_next.load(std::memory_order_acquire);
+			}
+		private:
+			static const size_t SEALED = size_t(1) << (sizeof(size_t) * 8 - 1);
+			char pad0[CACHE_LINE_SIZE];
+			std::atomic<size_t> m_enqueuePos;
+			char pad1[CACHE_LINE_SIZE];
+			std::atomic<size_t> m_dequeuePos;
+			char pad2[CACHE_LINE_SIZE];
+			void* m_mem;
+			Cell* m_cells;
+			size_t m_mask;
+			std::atomic<ChannelRing*> m_next;
+		};
+	}
+
+	// MPMC channel between coroutines, or plain threads. Items live in
+	// lock-free rings in the creating group's node-local memory; the
+	// channel's mutex is only taken when somebody has to wait.
+	//
+	// A bounded channel holds capacity items, rounded up to a power of two.
+	// An unbounded one starts at SEGMENT items and chains a ring of twice
+	// the size whenever the last one fills up. Drained rings are only freed
+	// with the channel, which keeps at most twice the largest backlog.
+	template<class T>
+	class Channel : public ChannelBase {
+	public:
+		static const size_t UNBOUNDED = 0;
+		static const size_t SEGMENT = 256;
+		explicit Channel(size_t capacity = UNBOUNDED)
+			: m_bounded(capacity != UNBOUNDED)
+		{
+			size_t size = 1;
+			while (size < (m_bounded ? capacity : SEGMENT)) {
+				size <<= 1;
+			}
+			m_first = new detail::ChannelRing<T>(size);
+			m_head.store(m_first, std::memory_order_relaxed);
+			m_tail.store(m_first, std::memory_order_relaxed);
+		}
+		~Channel() {
+			while (m_first) {
+				detail::ChannelRing<T>* next = m_first->next();
+				delete m_first;
+				m_first = next;
+			}
+		}
+		// waits for room, false once closed
+		template<class U>
+		bool send(U&& v) {
+			for (;;) {
+				if (closed()) {
+					return false;
+				}
+				if (push(std::forward<U>(v))) {
+					notifyReaders(1);
+					return true;
+				}
+				waitWritable();
+			}
+		}
+		// false when full or closed
+		template<class U>
+		bool trySend(U&& v) {
+			if (closed() || !push(std::forward<U>(v))) {
+				return false;
+			}
+			notifyReaders(1);
+			return true;
+		}
+		// waits for an item, false once closed and drained
+		bool recv(T& out) {
+			for (;;) {
+				if (tryRecv(out)) {
+					return true;
+				}
+				if (closed()) {
+					return tryRecv(out);
+				}
+				waitReadable();
+			}
+		}
+		bool tryRecv(T& out) {
+			if (!pop(out)) {
+				return false;
+			}
+			if (m_bounded) {
+				notifyWriters(1);
+			}
+			return true;
+		}
+		// Sends all count items, each run that fits taking its slots with a
+		// single reservation and waking receivers once. Returns how many
+		// went out, fewer only when the channel closed.
+		size_t sendBatch(const T* items, size_t count) {
+			size_t sent = 0;
+			while (sent < count && !closed()) {
+				size_t run = pushBatch(items + sent, count - sent);
+				if (run) {
+					sent += run;
+					notifyReaders(run);
+				} else {
+					waitWritable();
+				}
+			}
+			return sent;
+		}
+		// Waits for at least one item, then takes whatever else is there up
+		// to max. Returns 0 once closed and drained.
+		size_t recvBatch(T* out, size_t max) {
+			size_t got = 0;
+			for (;;) {
+				while (got < max && pop(out[got])) {
+					got++;
+				}
+				if (got || closed()) {
+					break;
+				}
+				waitReadable();
+			}
+			if (got && m_bounded) {
+				notifyWriters(got);
+			}
+			return got;
+		}
+		// items queued, a snapshot
+		size_t size() const {
+			size_t n = 0;
+			for (detail::ChannelRing<T>* ring = m_head.load(std::memory_order_acquire); ring; ring = ring->next()) {
+				n += ring->size();
+			}
+			return n;
+		}
+		bool readable() const {
+			return closed() || size() != 0;
+		}
+		bool writable() const {
+			return closed() || !m_bounded || m_first->size() < m_first->capacity();
+		}
+	private:
+		const bool m_bounded;
+		detail::ChannelRing<T>* m_first;
+		std::atomic<detail::ChannelRing<T>*> m_head;
+		std::atomic<detail::ChannelRing<T>*> m_tail;
+		sys::Mutex m_growLock;
+
+		template<class U>
+		bool push(U&& v) {
+			for (;;) {
+				detail::ChannelRing<T>* tail = m_tail.load(std::memory_order_acquire);
+				if (tail->tryPush(std::forward<U>(v))) {
+					return true;
+				}
+				if (m_bounded) {
+					return false;
+				}
+				grow(tail);
+			}
+		}
+		size_t pushBatch(const T* items, size_t count) {
+			for (;;) {
+				detail::ChannelRing<T>* tail = m_tail.load(std::memory_order_acquire);
+				size_t n = tail->tryPushBatch(items, count);
+				if (n || m_bounded) {
+					return n;
+				}
+				grow(tail);
+			}
+		}
+		bool pop(T& out) {
+			for (;;) {
+				detail::ChannelRing<T>* head = m_head.load(std::memory_order_acquire);
+				if (head->tryPop(out)) {
+					return true;
+				}
+				detail::ChannelRing<T>* next = head->drainedNext();
+				if (!next) {
+					return false;
+				}
+				m_head.compare_exchange_strong(head, next, std::memory_order_acq_rel);
+			}
+		}
+		void grow(detail::ChannelRing<T>* full) {
+			lock_guard<sys::Mutex> _(m_growLock);
+			if (m_tail.load(std::memory_order_relaxed) == full) {
+				detail::ChannelRing<T>* next = new detail::ChannelRing<T>(full->capacity() * 2);
+				full->seal(next);
+				m_tail.store(next, std::memory_order_release);
+			}
+		}
+	};
+}
+
+#endif
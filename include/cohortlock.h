@@ -0,0 +1,71 @@
+#ifndef _NUMA_COHORT_LOCK_H_
+#define _NUMA_COHORT_LOCK_H_
+#include "sync.h"
+#include "mempool.h"
+#include <atomic>
+
+namespace Task {
+	namespace sys {
+		// Lock word with a bounded spin before the thread sleeps on it. It
+		// may be released by another thread than the one that took it,
+		// which CohortLock relies on.
+		class SpinMutex : public noncopyable {
+		public:
+			static const int SPIN_COUNT = 256;
+			SpinMutex() : m_state(UNLOCKED), m_waiters(0) {}
+			void lock();
+			bool tryLock() {
+				int expected = UNLOCKED;
+				return m_state.compare_exchange_strong(expected, LOCKED, std::memory_order_acquire, std::memory_order_relaxed);
+			}
+			void unlock();
+			// somebody is trying to get it
+			bool hasWaiters() const {
+				return m_waiters.load(std::memory_order_relaxed) > 0;
+			}
+		private:
+			// SLEEPERS: locked, and a waiter may be asleep
+			enum { UNLOCKED = 0, LOCKED = 1, SLEEPERS = 2 };
+			std::atomic<int> m_state;
+			std::atomic<int> m_waiters;
+		};
+
+		// A SpinMutex per NUMA node in front of a global one. Unlock hands
+		// the global lock to a waiter on the holder's node, up to MAX_PASSES
+		// times in a row, before other nodes get their turn, so the lock and
+		// the data behind it mostly stay on one socket. A node that gave the
+		// global lock up lets waiting nodes take it first. Works as the
+		// LockType of ThreadSafePool.
+		class CohortLock : public noncopyable {
+		public:
+			static const int MAX_PASSES = 64;
+			// one cohort per node, nodes == 0 takes the machine's node count
+			explicit CohortLock(int nodes = 0);
+			~CohortLock();
+			void lock();
+			void unlock();
+			// NUMA node of the calling thread, looked up once per thread
+			static int currentNode();
+			// the node currentNode() reports for the calling thread from now
+			// on, for threads that are not pinned to one
+			static void setCurrentNode(int node);
+		private:
+			struct Local {
+				char pad0[CACHE_LINE_SIZE];
+				SpinMutex lock;
+				// the global lock came with the local one
+				bool globalHeld;
+				int passes;
+				char pad1[CACHE_LINE_SIZE];
+				Local() : globalHeld(false), passes(0) {}
+			};
+			SpinMutex m_global;
+			Local* m_locals;
+			int m_nodes;
+			// node of the current holder, or of the last one while it is free
+			std::atomic<int> m_owner;
+		};
+	}
+}
+
+#endif
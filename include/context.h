@@ -0,0 +1,49 @@
+#ifndef _NUMA_CONTEXT_H_
+#define _NUMA_CONTEXT_H_
+#include "localstorage.h"
+#include <cstddef>
+
+class coroutine_schedule;
+class NUMAExecutorGroup;
+
+namespace Task {
+	class Pool;
+	class Reactor;
+
+	// What a worker looks up on every submit, wake and allocation, kept in
+	// one static TLS block so a single thread pointer load reaches all of
+	// it. Zero on threads outside any pool.
+	struct WorkerContext {
+		Pool* pool;
+		coroutine_schedule* schedule;
+		// worker index + 1
+		size_t threadId;
+		Reactor* reactor;
+		// node-local allocator and blocking pool
+		NUMAExecutorGroup* group;
+	};
+
+	template<class Dummy = void>
+	struct WorkerContextBlock {
+		static NUMA_TLS WorkerContext s_context;
+	};
+	template<class Dummy> NUMA_TLS WorkerContext WorkerContextBlock<Dummy>::s_context;
+
+	inline WorkerContext& workerContext() {
+		return WorkerContextBlock<>::s_context;
+	}
+
+	// ThreadLocal look-alike for one field of the calling thread's context
+	template<class Ty, Ty WorkerContext::*Field>
+	class ContextLocal {
+	public:
+		void set(Ty p) const {
+			workerContext().*Field = p;
+		}
+		Ty get() const {
+			return workerContext().*Field;
+		}
+	};
+}
+
+#endif
@@ -8,12 +8,19 @@
 #include <stdint.h>
 #endif
 #include "localstorage.h"
+#include "intrusive.h"
+#include <type_traits>
 
 class coroutine_schedule;
 class coroutine;
+namespace Task {
+	class Pool;
+}
 typedef void(*coroutine_func_t)(void* ud);
+typedef void(*coroutine_hook_t)(void* ctx);
 
-class coroutine {
+// the list hook puts a coroutine on a run, free or wait list
+class coroutine : public Task::ListHook {
 public:
 	enum status_t {
 		DEAD = 0,
@@ -24,14 +31,53 @@ public:
 	};
 	coroutine(coroutine_func_t func, void* ud);
 	~coroutine();
+	// node >= 0 places the object and its stack in one mapping on that
+	// NUMA node; release with destroy(), which also takes plain new'ed ones
+	static coroutine* create(coroutine_func_t func, void* ud, int node = -1);
+	static void destroy(coroutine* co);
 	void resume(coroutine_schedule* schedule);
 	void reset(coroutine_func_t func, void* ud);
 	void setWaiting() {
 		m_status = WAITING;
 	}
+	// switch out as WAITING, then run hook(ctx) on the scheduler stack.
+	// Publishing the coroutine to a waker from the hook means nobody can
+	// resume it before it has left its stack.
+	void park(coroutine_hook_t hook, void* ctx);
 	status_t status() const {
 		return m_status;
 	}
+	coroutine_func_t func() const {
+		return m_func;
+	}
+	// scheduler bookkeeping, in TSC ticks
+	unsigned long long queuedAt() const {
+		return m_queuedAt;
+	}
+	void setQueuedAt(unsigned long long t) {
+		m_queuedAt = t;
+	}
+	// returns the CPU time of the current task so far
+	unsigned long long addRunTicks(unsigned long long t) {
+		return m_runTicks += t;
+	}
+	// the pool and worker that last resumed it, where it is woken
+	Task::Pool* home() const {
+		return m_home;
+	}
+	int homeWorker() const {
+		return m_homeWorker;
+	}
+	void setHome(Task::Pool* pool, int worker) {
+		m_home = pool;
+		m_homeWorker = worker;
+	}
+	// room for a task's captures, so closures up to this size need no
+	// allocation of their own
+	static const size_t CLOSURE_SIZE = 64;
+	void* closure() {
+		return &m_closure;
+	}
 
 	void yield();
 private:
@@ -41,6 +87,13 @@ private:
 	status_t m_status;
 	bool m_Exit;
 	int m_initTime;
+	coroutine_hook_t m_parkHook;
+	void * m_parkCtx;
+	unsigned long long m_queuedAt;
+	unsigned long long m_runTicks;
+	Task::Pool* m_home;
+	int m_homeWorker;
+	std::aligned_storage<CLOSURE_SIZE>::type m_closure;
 
 	void fiber_routine();
 #ifdef _WIN32
@@ -52,6 +105,11 @@ private:
 #else
 	ucontext_t m_ctx;
 	char *stack;
+	// the NUMA mapping holding this object, NULL when new'ed
+	void *m_mapping;
+	size_t m_mappingSize;
+	coroutine(coroutine_func_t func, void* ud, char* stack);
+	void init();
 	static void s_fiber_routine(uint32_t low32, uint32_t hi32);
 #endif
 	friend class coroutine_schedule;
@@ -66,7 +124,9 @@ public:
 		return m_running;
 	}
 	void yield(coroutine* co) const;
-	void resume(coroutine* co);
+	// returns the status the coroutine switched out with; read it from here,
+	// after a park hook ran the coroutine may already be running elsewhere
+	coroutine::status_t resume(coroutine* co);
 private:
 	coroutine* m_running;
 #ifdef _WIN32
@@ -0,0 +1,419 @@
+#ifndef _NUMA_FUTURE_H_
+#define _NUMA_FUTURE_H_
+#include "NUMAExecutorGroup.h"
+#include <atomic>
+#include <vector>
+#include <type_traits>
+
+namespace Task {
+
+	template<class T> class Future;
+	template<class T> class Promise;
+
+	namespace detail {
+		// run at completion on the completing thread, must not block
+		struct FutureCallback {
+			void (*fn)(FutureCallback*);
+			FutureCallback* next;
+			void* ctx;
+		};
+
+		// Shared state lives in the creating group's node-local pool.
+		// Callbacks sit on a lock-free list that is swapped for a sentinel
+		// on completion, so waiting and fan-in never take a lock.
+		class FutureState : public NodeLocal {
+		public:
+			FutureState() : m_callbacks(NULL), m_refs(1) {}
+			virtual ~FutureState() {}
+			void addRef() {
+				m_refs.fetch_add(1, std::memory_order_relaxed);
+			}
+			void release() {
+				if (m_refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+					delete this;
+				}
+			}
+			bool ready() const {
+				return m_callbacks.load(std::memory_order_acquire) == readyMark();
+			}
+			// runs cb right away when already complete
+			void addCallback(FutureCallback* cb) {
+				FutureCallback* head = m_callbacks.load(std::memory_order_acquire);
+				do {
+					if (head == readyMark()) {
+						cb->fn(cb);
+						return;
+					}
+					cb->next = head;
+				} while (!m_callbacks.compare_exchange_weak(head, cb, std::memory_order_release, std::memory_order_acquire));
+			}
+			void complete() {
+				FutureCallback* head = m_callbacks.exchange(readyMark(), std::memory_order_acq_rel);
+				assert(head != readyMark());
+				// registered LIFO, run in registration order
+				FutureCallback* list = NULL;
+				while (head) {
+					FutureCallback* next = head->next;
+					head->next = list;
+					list = head;
+					head = next;
+				}
+				while (list) {
+					// a waiter's node may vanish as soon as fn runs
+					FutureCallback* next = list->next;
+					list->fn(list);
+					list = next;
+				}
+			}
+			// suspends the running coroutine, or blocks the thread off-pool
+			void wait();
+		private:
+			std::atomic<FutureCallback*> m_callbacks;
+			std::atomic<int> m_refs;
+			static FutureCallback* readyMark() {
+				return reinterpret_cast<FutureCallback*>(1);
+			}
+		};
+
+		template<class T>
+		class FutureValue : public FutureState {
+		public:
+			FutureValue() {}
+			~FutureValue() {
+				if (ready()) {
+					value().~T();
+				}
+			}
+			void set(const T& v) {
+				new (&m_storage) T(v);
+				complete();
+			}
+			T& value() {
+				return *reinterpret_cast<T*>(&m_storage);
+			}
+		private:
+			typename std::aligned_storage<sizeof(T), std::alignment_of<T>::value>::type m_storage;
+		};
+
+		template<>
+		class FutureValue<void> : public FutureState {
+		public:
+			void set() {
+				complete();
+			}
+		};
+
+		// queue a continuation on the completing worker; off-pool it goes to
+		// the pool that was current when then() was called, or runs inline
+		void schedule(Pool* fallback, coroutine_func_t func, void* ud);
+
+		// P is always Promise<R>, left dependent so Promise may still be incomplete here
+		template<class T, class R>
+		struct Invoke {
+			template<class F, class P>
+			static void run(F& f, FutureValue<T>* src, P& dst) {
+				dst.setValue(f(src->value()));
+			}
+		};
+		template<class T>
+		struct Invoke<T, void> {
+			template<class F, class P>
+			static void run(F& f, FutureValue<T>* src, P& dst) {
+				f(src->value());
+				dst.setValue();
+			}
+		};
+		template<class R>
+		struct Invoke<void, R> {
+			template<class F, class P>
+			static void run(F& f, FutureValue<void>*, P& dst) {
+				dst.setValue(f());
+			}
+		};
+		template<>
+		struct Invoke<void, void> {
+			template<class F, class P>
+			static void run(F& f, FutureValue<void>*, P& dst) {
+				f();
+				dst.setValue();
+			}
+		};
+
+		template<class T, class F>
+		struct ResultOf {
+			typedef typename std::result_of<F(T&)>::type type;
+		};
+		template<class F>
+		struct ResultOf<void, F> {
+			typedef typename std::result_of<F()>::type type;
+		};
+
+		template<class T, class R, class F>
+		class Continuation : public NodeLocal {
+		public:
+			Continuation(FutureValue<T>* src, const F& f)
+				: m_src(src)
+				, m_func(f)
+				, m_pool(curPool.get())
+			{
+				m_src->addRef();
+				m_cb.fn = s_ready;
+				m_cb.ctx = this;
+			}
+			~Continuation() {
+				m_src->release();
+			}
+			Future<R> start() {
+				Future<R> res = m_result.getFuture();
+				m_src->addCallback(&m_cb);
+				return res;
+			}
+		private:
+			FutureCallback m_cb;
+			FutureValue<T>* m_src;
+			F m_func;
+			Pool* m_pool;
+			Promise<R> m_result;
+
+			static void s_ready(FutureCallback* cb) {
+				Continuation* self = reinterpret_cast<Continuation*>(cb->ctx);
+				schedule(self->m_pool, s_run, self);
+			}
+			static void s_run(void* p) {
+				Continuation* self = reinterpret_cast<Continuation*>(p);
+				Invoke<T, R>::run(self->m_func, self->m_src, self->m_result);
+				delete self;
+			}
+		};
+	}
+
+	template<class T>
+	class FutureBase {
+	public:
+		bool valid() const {
+			return m_state != NULL;
+		}
+		bool ready() const {
+			return m_state && m_state->ready();
+		}
+		void wait() const {
+			m_state->wait();
+		}
+		// f receives the value (nothing for Future<void>) and runs as a task
+		// on the worker that completed this future
+		template<class F>
+		Future<typename detail::ResultOf<T, F>::type> then(const F& f) const {
+			typedef typename detail::ResultOf<T, F>::type R;
+			return (new detail::Continuation<T, R, F>(m_state, f))->start();
+		}
+	protected:
+		FutureBase(detail::FutureValue<T>* state = NULL) : m_state(state) {
+			if (m_state) {
+				m_state->addRef();
+			}
+		}
+		FutureBase(const FutureBase& rhs) : m_state(rhs.m_state) {
+			if (m_state) {
+				m_state->addRef();
+			}
+		}
+		~FutureBase() {
+			if (m_state) {
+				m_state->release();
+			}
+		}
+		void assign(const FutureBase& rhs) {
+			if (rhs.m_state) {
+				rhs.m_state->addRef();
+			}
+			if (m_state) {
+				m_state->release();
+			}
+			m_state = rhs.m_state;
+		}
+		detail::FutureValue<T>* m_state;
+		friend detail::FutureState* stateOf(const FutureBase& f) {
+			return f.m_state;
+		}
+	};
+
+	template<class T>
+	class Future : public FutureBase<T> {
+	public:
+		Future() {}
+		Future(const Future& rhs) : FutureBase<T>(rhs) {}
+		Future& operator=(const Future& rhs) {
+			this->assign(rhs);
+			return *this;
+		}
+		T& get() const {
+			this->wait();
+			return this->m_state->value();
+		}
+	private:
+		explicit Future(detail::FutureValue<T>* state) : FutureBase<T>(state) {}
+		friend class Promise<T>;
+	};
+
+	template<>
+	class Future<void> : public FutureBase<void> {
+	public:
+		Future() {}
+		Future(const Future& rhs) : FutureBase<void>(rhs) {}
+		Future& operator=(const Future& rhs) {
+			this->assign(rhs);
+			return *this;
+		}
+		void get() const {
+			this->wait();
+		}
+	private:
+		explicit Future(detail::FutureValue<void>* state) : FutureBase<void>(state) {}
+		friend class Promise<void>;
+	};
+
+	// Every Promise must be fulfilled exactly once, waiters on an abandoned
+	// promise are never woken.
+	template<class T>
+	class Promise {
+	public:
+		Promise() : m_state(new detail::FutureValue<T>) {}
+		Promise(const Promise& rhs) : m_state(rhs.m_state) {
+			m_state->addRef();
+		}
+		~Promise() {
+			m_state->release();
+		}
+		Future<T> getFuture() const {
+			return Future<T>(m_state);
+		}
+		// the waiter may destroy this Promise as soon as it wakes, so hold the
+		// state across completion
+		void setValue(const T& v) {
+			detail::FutureValue<T>* state = m_state;
+			state->addRef();
+			state->set(v);
+			state->release();
+		}
+	private:
+		void operator=(const Promise&);
+		detail::FutureValue<T>* m_state;
+	};
+
+	template<>
+	class Promise<void> {
+	public:
+		Promise() : m_state(new detail::FutureValue<void>) {}
+		Promise(const Promise& rhs) : m_state(rhs.m_state) {
+			m_state->addRef();
+		}
+		~Promise() {
+			m_state->release();
+		}
+		Future<void> getFuture() const {
+			return Future<void>(m_state);
+		}
+		void setValue() {
+			detail::FutureValue<void>* state = m_state;
+			state->addRef();
+			state->set();
+			state->release();
+		}
+	private:
+		void operator=(const Promise&);
+		detail::FutureValue<void>* m_state;
+	};
+
+	namespace detail {
+		// One block holds the counter and a callback node per child, each
+		// child completion is a single atomic decrement.
+		class FanIn : public NodeLocal {
+		public:
+			struct Node {
+				FutureCallback cb;
+				size_t index;
+			};
+			static FanIn* create(size_t count, bool any) {
+				void* mem = NUMAExecutorGroup::localAlloc(sizeof(FanIn) + count * sizeof(Node));
+				if (!mem) {
+					throw std::bad_alloc();
+				}
+				return ::new (mem) FanIn(count, any);
+			}
+			void attach(FutureState* child, size_t index) {
+				Node& n = nodes()[index];
+				n.cb.fn = s_fire;
+				n.cb.ctx = this;
+				n.index = index;
+				child->addCallback(&n.cb);
+			}
+			Future<void> all() const {
+				return m_all.getFuture();
+			}
+			Future<size_t> any() const {
+				return m_any.getFuture();
+			}
+		private:
+			std::atomic<size_t> m_remaining;
+			std::atomic<bool> m_won;
+			bool m_isAny;
+			Promise<void> m_all;
+			Promise<size_t> m_any;
+
+			FanIn(size_t count, bool any)
+				: m_remaining(count)
+				, m_won(false)
+				, m_isAny(any)
+			{}
+			Node* nodes() {
+				return reinterpret_cast<Node*>(this + 1);
+			}
+			static void s_fire(FutureCallback* cb) {
+				Node* n = reinterpret_cast<Node*>(cb);
+				FanIn* self = reinterpret_cast<FanIn*>(cb->ctx);
+				if (self->m_isAny && !self->m_won.exchange(true, std::memory_order_acq_rel)) {
+					self->m_any.setValue(n->index);
+				}
+				// every child holds a node in the block, the last one frees it
+				if (self->m_remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+					if (!self->m_isAny) {
+						self->m_all.setValue();
+					}
+					self->~FanIn();
+					NUMAExecutorGroup::localFree(self);
+				}
+			}
+		};
+	}
+
+	// ready once every future in the list is ready
+	template<class T>
+	Future<void> when_all(const std::vector<Future<T> >& futures) {
+		if (futures.empty()) {
+			Promise<void> p;
+			p.setValue();
+			return p.getFuture();
+		}
+		detail::FanIn* fan = detail::FanIn::create(futures.size(), false);
+		Future<void> res = fan->all();
+		for (size_t i = 0; i < futures.size(); i++) {
+			fan->attach(stateOf(futures[i]), i);
+		}
+		return res;
+	}
+
+	// yields the index of the first future to become ready. The bookkeeping
+	// block is released when the last child completes.
+	template<class T>
+	Future<size_t> when_any(const std::vector<Future<T> >& futures) {
+		assert(!futures.empty());
+		detail::FanIn* fan = detail::FanIn::create(futures.size(), true);
+		Future<size_t> res = fan->any();
+		for (size_t i = 0; i < futures.size(); i++) {
+			fan->attach(stateOf(futures[i]), i);
+		}
+		return res;
+	}
+}
+
+#endif
@@ -0,0 +1,126 @@
+#ifndef _NUMA_HANDOFF_H_
+#define _NUMA_HANDOFF_H_
+#include "channel.h"
+#include <string.h>
+
+namespace Task {
+
+	// One-way link that carries tasks into another executor group. Entries
+	// go through a lock-free ring whose cells live on the destination's node,
+	// and a single drain task there turns them into local tasks, so senders
+	// never take a remote worker's queue lock and the destination is poked
+	// once per burst instead of once per task.
+	//
+	// send() pushes one entry; Batch gathers up to BATCH entries on the
+	// sender's stack and pushes them with one ring reservation. A full ring
+	// makes senders yield until the destination catches up. Entries the
+	// destination's admission limit refuses stay queued until it has room.
+	class Handoff : public NodeLocal {
+	public:
+		static const size_t DEFAULT_CAPACITY = 4096;
+		static const size_t BATCH = 32;
+		// bytes send() copies along with a task
+		static const size_t PAYLOAD_SIZE = 32;
+	private:
+		// a ring cell with its sequence word fills one cache line
+		struct Entry {
+			coroutine_func_t func;
+			void* ud;
+			size_t size;
+			char payload[PAYLOAD_SIZE];
+			void set(coroutine_func_t f, void* u) {
+				func = f;
+				ud = u;
+				size = 0;
+			}
+			void set(coroutine_func_t f, const void* data, size_t n) {
+				assert(n && n <= PAYLOAD_SIZE);
+				func = f;
+				ud = NULL;
+				size = n;
+				memcpy(payload, data, n);
+			}
+		};
+	public:
+		// capacity is rounded up to a power of two
+		explicit Handoff(NUMAExecutorGroup& dst, size_t capacity = DEFAULT_CAPACITY);
+		// senders must have stopped; waits until everything is handed over
+		~Handoff();
+		NUMAExecutorGroup& destination() const {
+			return m_dst;
+		}
+		// entries not yet picked up by the destination
+		size_t pending() const {
+			return m_ring->size();
+		}
+		void send(coroutine_func_t func, void* ud) {
+			Entry e;
+			e.set(func, ud);
+			push(&e, 1);
+		}
+		// func gets a pointer to a copy of data that lives as long as its task
+		void send(coroutine_func_t func, const void* data, size_t size) {
+			Entry e;
+			e.set(func, data, size);
+			push(&e, 1);
+		}
+
+		class Batch : public noncopyable {
+		public:
+			explicit Batch(Handoff& link) : m_link(link), m_count(0) {}
+			~Batch() {
+				flush();
+			}
+			void add(coroutine_func_t func, void* ud) {
+				m_entries[m_count++].set(func, ud);
+				if (m_count == BATCH) {
+					flush();
+				}
+			}
+			void add(coroutine_func_t func, const void* data, size_t size) {
+				m_entries[m_count++].set(func, data, size);
+				if (m_count == BATCH) {
+					flush();
+				}
+			}
+			void flush() {
+				m_link.push(m_entries, m_count);
+				m_count = 0;
+			}
+		private:
+			Handoff& m_link;
+			size_t m_count;
+			Entry m_entries[BATCH];
+		};
+	private:
+		NUMAExecutorGroup& m_dst;
+		detail::ChannelRing<Entry>* m_ring;
+		// a drain task is queued or running on the destination
+		std::atomic<bool> m_scheduled;
+
+		void push(Entry* entries, size_t count);
+		void schedule();
+		void drain();
+		bool handOver(Pool& pool, Entry& e);
+		static void s_drain(void* ctx);
+	};
+
+	// Handoff links between every pair of groups, one per (source,
+	// destination). Senders pick theirs by the group they run on.
+	class HandoffMesh : public noncopyable {
+	public:
+		HandoffMesh(const std::vector<NUMAExecutorGroup*>& groups, size_t capacity = Handoff::DEFAULT_CAPACITY);
+		~HandoffMesh();
+		// link from the caller's group into groups[dst]; callers outside the
+		// groups share the first group's links
+		Handoff& to(size_t dst);
+		Handoff& link(size_t src, size_t dst) {
+			return *m_links[src * m_groups.size() + dst];
+		}
+	private:
+		std::vector<NUMAExecutorGroup*> m_groups;
+		std::vector<Handoff*> m_links;
+	};
+}
+
+#endif
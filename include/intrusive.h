@@ -0,0 +1,129 @@
+#ifndef _NUMA_INTRUSIVE_H_
+#define _NUMA_INTRUSIVE_H_
+#include "noncopyable.h"
+#include <cassert>
+#include <cstddef>
+
+namespace Task {
+	template<class T> class IntrusiveList;
+
+	// Link fields embedded in the element itself, so putting it on a list
+	// never allocates. An element sits on at most one list at a time.
+	class ListHook {
+	public:
+		ListHook() : m_next(NULL), m_prev(NULL) {}
+	private:
+		ListHook* m_next;
+		ListHook* m_prev;
+		template<class T> friend class IntrusiveList;
+	};
+
+	// Doubly linked list of T : ListHook with deque-like names. front() and
+	// back() return NULL when empty, remove() is O(1).
+	template<class T>
+	class IntrusiveList : public noncopyable {
+	public:
+		IntrusiveList() : m_head(NULL), m_tail(NULL), m_size(0) {}
+		bool empty() const {
+			return m_head == NULL;
+		}
+		size_t size() const {
+			return m_size;
+		}
+		T* front() const {
+			return elem(m_head);
+		}
+		T* back() const {
+			return elem(m_tail);
+		}
+		static T* next(T* e) {
+			return elem(hook(e)->m_next);
+		}
+		void push_back(T* e) {
+			ListHook* h = hook(e);
+			assert(!h->m_next && !h->m_prev && m_head != h);
+			h->m_prev = m_tail;
+			if (m_tail) {
+				m_tail->m_next = h;
+			} else {
+				m_head = h;
+			}
+			m_tail = h;
+			m_size++;
+		}
+		void push_front(T* e) {
+			ListHook* h = hook(e);
+			assert(!h->m_next && !h->m_prev && m_head != h);
+			h->m_next = m_head;
+			if (m_head) {
+				m_head->m_prev = h;
+			} else {
+				m_tail = h;
+			}
+			m_head = h;
+			m_size++;
+		}
+		void pop_front() {
+			remove(front());
+		}
+		void pop_back() {
+			remove(back());
+		}
+		// e must be on this list
+		void remove(T* e) {
+			ListHook* h = hook(e);
+			if (h->m_prev) {
+				h->m_prev->m_next = h->m_next;
+			} else {
+				m_head = h->m_next;
+			}
+			if (h->m_next) {
+				h->m_next->m_prev = h->m_prev;
+			} else {
+				m_tail = h->m_prev;
+			}
+			h->m_next = h->m_prev = NULL;
+			m_size--;
+		}
+		// moves all of rhs in front of this list's elements, keeping its order
+		void splice_front(IntrusiveList& rhs) {
+			if (rhs.empty()) {
+				return;
+			}
+			rhs.m_tail->m_next = m_head;
+			if (m_head) {
+				m_head->m_prev = rhs.m_tail;
+			} else {
+				m_tail = rhs.m_tail;
+			}
+			m_head = rhs.m_head;
+			m_size += rhs.m_size;
+			rhs.m_head = rhs.m_tail = NULL;
+			rhs.m_size = 0;
+		}
+		void swap(IntrusiveList& rhs) {
+			ListHook* head = m_head;
+			ListHook* tail = m_tail;
+			size_t size = m_size;
+			m_head = rhs.m_head;
+			m_tail = rhs.m_tail;
+			m_size = rhs.m_size;
+			rhs.m_head = head;
+			rhs.m_tail = tail;
+			rhs.m_size = size;
+		}
+	private:
+		ListHook* m_head;
+		ListHook* m_tail;
+		size_t m_size;
+
+		static ListHook* hook(T* e) {
+			return e;
+		}
+		static T* elem(ListHook* h) {
+			return static_cast<T*>(h);
+		}
+	};
+}
+
+#endif
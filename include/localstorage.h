@@ -2,6 +2,30 @@
 #define _NUMA_LOCAL_STORAGE_H_
 
 #include <new>
+#include <atomic>
+
+// Static TLS: resolved at load time, so an access is one load off the
+// thread pointer instead of a TlsGetValue/pthread_getspecific call.
+#ifdef _MSC_VER
+#define NUMA_TLS __declspec(thread)
+#else
+#define NUMA_TLS __thread __attribute__((tls_model("initial-exec")))
+#endif
+
+// One static TLS slot per ThreadLocal instance. Slots are never reused, so
+// a new instance always starts out NULL on every thread; instances past
+// MAX_SLOTS fall back to the OS calls.
+template<class Dummy = void>
+struct ThreadLocalSlots {
+	static const int MAX_SLOTS = 64;
+	static NUMA_TLS void* s_values[MAX_SLOTS];
+	static std::atomic<int> s_next;
+	static int allocate() {
+		return s_next.fetch_add(1, std::memory_order_relaxed);
+	}
+};
+template<class Dummy> NUMA_TLS void* ThreadLocalSlots<Dummy>::s_values[ThreadLocalSlots<Dummy>::MAX_SLOTS];
+template<class Dummy> std::atomic<int> ThreadLocalSlots<Dummy>::s_next(0);
 
 #ifdef _WIN32
 
@@ -9,23 +33,37 @@
 		
 template<typename Ty, int size = sizeof(Ty)>
 class ThreadLocal {
+	typedef ThreadLocalSlots<> slots;
 public:
-	ThreadLocal() {
+	ThreadLocal() : m_slot(slots::allocate()) {
+		if (m_slot < slots::MAX_SLOTS) {
+			return;
+		}
 		m_tlsId = ::TlsAlloc();
 		if (TLS_OUT_OF_INDEXES == m_tlsId) {
 			throw std::bad_alloc();
 		}
 	}
 	~ThreadLocal() {
-		::TlsFree(m_tlsId);
+		if (m_slot >= slots::MAX_SLOTS) {
+			::TlsFree(m_tlsId);
+		}
 	}
 	void set(Ty p) const {
-		::TlsSetValue(m_tlsId, LPVOID(p));
+		if (m_slot < slots::MAX_SLOTS) {
+			slots::s_values[m_slot] = LPVOID(p);
+		} else {
+			::TlsSetValue(m_tlsId, LPVOID(p));
+		}
 	}
 	Ty get()  const {
+		if (m_slot < slots::MAX_SLOTS) {
+			return Ty(slots::s_values[m_slot]);
+		}
 		return Ty(::TlsGetValue(m_tlsId));
 	}
 private:
+	int m_slot;
 	DWORD m_tlsId;
 };
 
@@ -34,22 +72,36 @@ private:
 
 template<typename Ty>
 class ThreadLocal {
+	typedef ThreadLocalSlots<> slots;
 public:
-	ThreadLocal() {
+	ThreadLocal() : m_slot(slots::allocate()) {
+		if (m_slot < slots::MAX_SLOTS) {
+			return;
+		}
 		if (pthread_key_create(&m_key, NULL) != 0) {
 			throw std::bad_alloc();
 		}
 	}
 	~ThreadLocal() {
-		pthread_key_delete(m_key);
+		if (m_slot >= slots::MAX_SLOTS) {
+			pthread_key_delete(m_key);
+		}
 	}
 	void set(Ty p) const {
-		pthread_setspecific(m_key, (const void*)p);
+		if (m_slot < slots::MAX_SLOTS) {
+			slots::s_values[m_slot] = (void*)p;
+		} else {
+			pthread_setspecific(m_key, (const void*)p);
+		}
 	}
 	Ty get() const {
+		if (m_slot < slots::MAX_SLOTS) {
+			return Ty(slots::s_values[m_slot]);
+		}
 		return Ty(pthread_getspecific(m_key));
 	}
 private:
+	int m_slot;
 	pthread_key_t m_key;
 };
 
@@ -17,6 +17,8 @@
 #define MEM_ALIGN(size, boundary) \
     (((size) + ((boundary) - 1)) & ~((boundary) - 1))
 
+#define CACHE_LINE_SIZE 64
+
 // ڴزᶯ̬ռ
 // boundaryȡֵΪ8 16 32
 template<
@@ -176,7 +178,7 @@ private:
 		if (!mem) {
 			mem = numa_alloc_interleaved(m_size);
 		}
-		MemNode * node = static_cast<MemNode*>(::malloc(m_size));
+		MemNode * node = static_cast<MemNode*>(mem);
 		if (!node) {
 			return NULL;
 		}
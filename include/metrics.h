@@ -0,0 +1,152 @@
+#ifndef _NUMA_METRICS_H_
+#define _NUMA_METRICS_H_
+#include "mempool.h"
+#include "trace.h"
+#include <atomic>
+#include <vector>
+#include <stdint.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace Task {
+
+	// Log-linear histogram: every power of two is split into 2^SUB_BITS
+	// buckets, so any value is off by at most 1/8. Values are TSC ticks.
+	// Single writer, readers may snapshot at any time.
+	class Histogram : public noncopyable {
+	public:
+		static const int SUB_BITS = 3;
+		static const int SUB_BUCKETS = 1 << SUB_BITS;
+		static const int BUCKETS = (64 - SUB_BITS + 1) * SUB_BUCKETS;
+		Histogram() {
+			for (int i = 0; i < BUCKETS; i++) {
+				m_counts[i].store(0, std::memory_order_relaxed);
+			}
+			m_sum.store(0, std::memory_order_relaxed);
+		}
+		void record(uint64_t v) {
+			std::atomic<uint64_t>& c = m_counts[index(v)];
+			c.store(c.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+			m_sum.store(m_sum.load(std::memory_order_relaxed) + v, std::memory_order_relaxed);
+		}
+		uint64_t count(int bucket) const {
+			return m_counts[bucket].load(std::memory_order_relaxed);
+		}
+		uint64_t sum() const {
+			return m_sum.load(std::memory_order_relaxed);
+		}
+		static int index(uint64_t v) {
+			if (v < SUB_BUCKETS) {
+				return int(v);
+			}
+			int shift = msb(v) - SUB_BITS;
+			return ((shift + 1) << SUB_BITS) + int((v >> shift) & (SUB_BUCKETS - 1));
+		}
+		static uint64_t lowerBound(int bucket) {
+			if (bucket < SUB_BUCKETS) {
+				return uint64_t(bucket);
+			}
+			int shift = (bucket >> SUB_BITS) - 1;
+			return uint64_t(SUB_BUCKETS + (bucket & (SUB_BUCKETS - 1))) << shift;
+		}
+	private:
+		std::atomic<uint64_t> m_counts[BUCKETS];
+		std::atomic<uint64_t> m_sum;
+
+		static int msb(uint64_t v) {
+#ifdef _MSC_VER
+			unsigned long r;
+			_BitScanReverse64(&r, v);
+			return int(r);
+#else
+			return 63 - __builtin_clzll(v);
+#endif
+		}
+	};
+
+	// a copy of one or more Histograms, reported in nanoseconds
+	class HistogramSnapshot {
+	public:
+		HistogramSnapshot() : m_counts(Histogram::BUCKETS, 0), m_total(0), m_sum(0) {}
+		void add(const Histogram& h);
+		void merge(const HistogramSnapshot& rhs);
+		uint64_t count() const {
+			return m_total;
+		}
+		double mean() const;
+		// p in [0, 1], e.g. 0.99
+		double percentile(double p) const;
+	private:
+		std::vector<uint64_t> m_counts;
+		uint64_t m_total;
+		uint64_t m_sum;
+	};
+
+	// Live counters of one worker. Only that worker writes them, with plain
+	// relaxed stores, and the padding keeps neighbouring workers off its
+	// cache lines.
+	struct WorkerStats {
+		char pad0[CACHE_LINE_SIZE];
+		std::atomic<uint64_t> tasksRun;
+		std::atomic<uint64_t> resumes;
+		std::atomic<uint64_t> steals;
+		std::atomic<uint64_t> failedSteals;
+		std::atomic<uint64_t> parks;
+		std::atomic<uint64_t> unparks;
+		std::atomic<uint64_t> coroutinesCreated;
+		std::atomic<uint64_t> coroutinesRecycled;
+		// idle ones freed by the cache caps and trimming
+		std::atomic<uint64_t> coroutinesFreed;
+		// submissions refused by admission control
+		std::atomic<uint64_t> tasksRejected;
+		Histogram queueWait;
+		Histogram runTime;
+		char pad1[CACHE_LINE_SIZE];
+
+		WorkerStats();
+		// owner is false for the shared slot fed by threads outside the pool
+		static void bump(std::atomic<uint64_t>& c, bool owner) {
+			if (owner) {
+				c.store(c.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+			} else {
+				c.fetch_add(1, std::memory_order_relaxed);
+			}
+		}
+	};
+
+	struct WorkerMetrics {
+		uint64_t tasksRun;
+		uint64_t resumes;
+		uint64_t steals;
+		uint64_t failedSteals;
+		uint64_t parks;
+		uint64_t unparks;
+		uint64_t coroutinesCreated;
+		uint64_t coroutinesRecycled;
+		uint64_t coroutinesFreed;
+		uint64_t tasksRejected;
+		size_t queueDepth;
+		// time spent runnable in a queue before each resume
+		HistogramSnapshot queueWait;
+		// time on CPU per finished task, summed over all its slices
+		HistogramSnapshot runTime;
+
+		WorkerMetrics();
+		void add(const WorkerStats& s);
+		void merge(const WorkerMetrics& rhs);
+	};
+
+	struct PoolMetrics {
+		// one entry per worker, submissions from outside the pool are
+		// only part of total
+		std::vector<WorkerMetrics> workers;
+		WorkerMetrics total;
+		void merge(const PoolMetrics& rhs) {
+			workers.insert(workers.end(), rhs.workers.begin(), rhs.workers.end());
+			total.merge(rhs.total);
+		}
+	};
+}
+
+#endif
@@ -0,0 +1,303 @@
+#ifndef _NUMA_PARALLEL_H_
+#define _NUMA_PARALLEL_H_
+#include "future.h"
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// Loop bodies take a half-open index range: body(size_t lo, size_t hi).
+// grain == 0 picks a grain size from the range and the pool width.
+namespace Task {
+
+	namespace detail {
+		inline int log2ceil(int v) {
+			int r = 0;
+			while ((1 << r) < v) {
+				r++;
+			}
+			return r;
+		}
+
+		// Auto-partitioned loop over [lo, hi) on one pool. Every piece splits
+		// its range in half, pushing the upper half to the local worker queue,
+		// until it is down to the grain or its split budget runs out. The
+		// budget starts at about two pieces per worker and is topped up when a
+		// piece is stolen, so splitting follows actual load imbalance.
+		template<class Leaf>
+		class LoopJob : public noncopyable {
+		public:
+			LoopJob(Pool& pool, const Leaf& leaf, size_t lo, size_t hi, size_t grain)
+				: m_pool(pool)
+				, m_leaf(leaf)
+				, m_lo(lo)
+				, m_hi(hi)
+				, m_pending(1)
+			{
+				int threads = pool.threadCount();
+				m_grain = grain ? grain : std::max<size_t>(1, (hi - lo) / (threads * 32));
+				m_depth = log2ceil(threads) + 1;
+				m_stealDepth = log2ceil(threads);
+			}
+			// runs the root on the caller when it is a worker of this pool
+			Future<void> start() {
+				Future<void> res = m_done.getFuture();
+				if (m_lo >= m_hi) {
+					m_done.setValue();
+				} else if (curPool.get() == &m_pool) {
+					run(m_lo, m_hi, m_depth);
+				} else {
+					submit(m_lo, m_hi, m_depth, -1);
+				}
+				return res;
+			}
+		private:
+			struct Piece : public NodeLocal {
+				LoopJob* job;
+				size_t lo;
+				size_t hi;
+				int depth;
+				int spawner;
+			};
+			Pool& m_pool;
+			const Leaf& m_leaf;
+			size_t m_lo;
+			size_t m_hi;
+			size_t m_grain;
+			int m_depth;
+			int m_stealDepth;
+			std::atomic<long> m_pending;
+			Promise<void> m_done;
+
+			void run(size_t lo, size_t hi, int depth) {
+				while (hi - lo > m_grain && depth > 0) {
+					size_t mid = lo + (hi - lo) / 2;
+					depth--;
+					m_pending.fetch_add(1, std::memory_order_relaxed);
+					submit(mid, hi, depth, Pool::currentWorker());
+					hi = mid;
+				}
+				m_leaf(lo, hi);
+				if (m_pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+					m_done.setValue();
+				}
+			}
+			void submit(size_t lo, size_t hi, int depth, int worker) {
+				Piece* p = new Piece;
+				p->job = this;
+				p->lo = lo;
+				p->hi = hi;
+				p->depth = depth;
+				p->spawner = worker;
+				m_pool.addInlineContinuation(s_piece, p, worker);
+			}
+			static void s_piece(void* ud) {
+				Piece* p = reinterpret_cast<Piece*>(ud);
+				LoopJob* job = p->job;
+				size_t lo = p->lo;
+				size_t hi = p->hi;
+				int depth = p->depth;
+				if (p->spawner != -1 && p->spawner != Pool::currentWorker()) {
+					depth += job->m_stealDepth;
+				}
+				delete p;
+				job->run(lo, hi, depth);
+			}
+		};
+
+		template<class Body>
+		struct ForLeaf {
+			const Body& body;
+			ForLeaf(const Body& b) : body(b) {}
+			void operator()(size_t lo, size_t hi) const {
+				body(lo, hi);
+			}
+		};
+
+		// one partial result per worker, each on its own cache line
+		template<class T>
+		class ReduceSlots : public noncopyable {
+		public:
+			ReduceSlots(int count, const T& identity) : m_count(count) {
+				m_mem = NUMAExecutorGroup::localAlloc(count * sizeof(Slot) + CACHE_LINE_SIZE);
+				if (!m_mem) {
+					throw std::bad_alloc();
+				}
+				m_slots = reinterpret_cast<Slot*>(MEM_ALIGN(reinterpret_cast<uintptr_t>(m_mem), CACHE_LINE_SIZE));
+				for (int i = 0; i < count; i++) {
+					new (&m_slots[i]) Slot(identity);
+				}
+			}
+			~ReduceSlots() {
+				for (int i = 0; i < m_count; i++) {
+					m_slots[i].~Slot();
+				}
+				NUMAExecutorGroup::localFree(m_mem);
+			}
+			template<class Combine>
+			void add(int worker, const T& part, const Combine& combine) {
+				combine(m_slots[worker].value, part);
+			}
+			template<class Combine>
+			void collect(T& result, const Combine& combine) const {
+				for (int i = 0; i < m_count; i++) {
+					combine(result, m_slots[i].value);
+				}
+			}
+		private:
+			struct alignas(CACHE_LINE_SIZE) Slot {
+				T value;
+				Slot(const T& v) : value(v) {}
+			};
+			Slot* m_slots;
+			void* m_mem;
+			int m_count;
+		};
+
+		template<class T, class Body, class Combine>
+		struct ReduceLeaf {
+			ReduceSlots<T>& slots;
+			const Body& body;
+			const Combine& combine;
+			ReduceLeaf(ReduceSlots<T>& s, const Body& b, const Combine& c) : slots(s), body(b), combine(c) {}
+			// body may suspend, the slot is only touched once it returns
+			void operator()(size_t lo, size_t hi) const {
+				T part = body(lo, hi);
+				slots.add(Pool::currentWorker(), part, combine);
+			}
+		};
+
+		template<class T, class Body, class Combine>
+		struct GroupReduce {
+			ReduceSlots<T> slots;
+			ReduceLeaf<T, Body, Combine> leaf;
+			LoopJob<ReduceLeaf<T, Body, Combine> > job;
+			GroupReduce(Pool& pool, const T& identity, const Body& body, const Combine& combine, size_t lo, size_t hi, size_t grain)
+				: slots(pool.threadCount(), identity)
+				, leaf(slots, body, combine)
+				, job(pool, leaf, lo, hi, grain)
+			{}
+		};
+
+		// other pools first, the caller's own slice last since it runs inline
+		template<class Job>
+		void runJobs(const std::vector<Job*>& jobs, const std::vector<NUMAExecutorGroup*>& groups) {
+			std::vector<Future<void> > done;
+			size_t own = jobs.size();
+			for (size_t i = 0; i < jobs.size(); i++) {
+				if (curPool.get() == &groups[i]->taskPool()) {
+					own = i;
+				} else {
+					done.push_back(jobs[i]->start());
+				}
+			}
+			if (own != jobs.size()) {
+				done.push_back(jobs[own]->start());
+			}
+			when_all(done).get();
+		}
+	}
+
+	template<class Body>
+	void parallel_for(Pool& pool, size_t lo, size_t hi, const Body& body, size_t grain = 0) {
+		detail::ForLeaf<Body> leaf(body);
+		detail::LoopJob<detail::ForLeaf<Body> > job(pool, leaf, lo, hi, grain);
+		job.start().get();
+	}
+
+	// body(lo, hi) returns the partial result of its range,
+	// combine(T& acc, const T& part) folds a partial into an accumulator
+	template<class T, class Body, class Combine>
+	T parallel_reduce(Pool& pool, size_t lo, size_t hi, const T& identity, const Body& body, const Combine& combine, size_t grain = 0) {
+		detail::ReduceSlots<T> slots(pool.threadCount(), identity);
+		detail::ReduceLeaf<T, Body, Combine> leaf(slots, body, combine);
+		detail::LoopJob<detail::ReduceLeaf<T, Body, Combine> > job(pool, leaf, lo, hi, grain);
+		job.start().get();
+		T result = identity;
+		slots.collect(result, combine);
+		return result;
+	}
+
+	// Two passes over a static partition of 4 blocks per worker:
+	// reduce(lo, hi) returns a block's total, then scan(lo, hi, prefix) is
+	// called per block with the combined total of everything before it.
+	// Returns the grand total.
+	template<class T, class Reduce, class Scan, class Combine>
+	T parallel_scan(Pool& pool, size_t lo, size_t hi, const T& identity, const Reduce& reduce, const Scan& scan, const Combine& combine) {
+		size_t n = hi > lo ? hi - lo : 0;
+		size_t blocks = std::min<size_t>(n, size_t(pool.threadCount()) * 4);
+		if (blocks == 0) {
+			return identity;
+		}
+		std::vector<T> sums(blocks, identity);
+		parallel_for(pool, 0, blocks, [&](size_t b0, size_t b1) {
+			for (size_t b = b0; b < b1; b++) {
+				sums[b] = reduce(lo + n * b / blocks, lo + n * (b + 1) / blocks);
+			}
+		}, 1);
+		T total = identity;
+		for (size_t b = 0; b < blocks; b++) {
+			T part = sums[b];
+			sums[b] = total;
+			combine(total, part);
+		}
+		parallel_for(pool, 0, blocks, [&](size_t b0, size_t b1) {
+			for (size_t b = b0; b < b1; b++) {
+				scan(lo + n * b / blocks, lo + n * (b + 1) / blocks, sums[b]);
+			}
+		}, 1);
+		return total;
+	}
+
+	// NUMA-partitioned mode: slice i, [bounds[i], bounds[i+1]), only runs on
+	// groups[i]'s workers, so it stays on the node that holds its data.
+
+	// contiguous slices sized by each group's thread count
+	inline std::vector<size_t> partition(const std::vector<NUMAExecutorGroup*>& groups, size_t lo, size_t hi) {
+		size_t total = 0;
+		for (size_t i = 0; i < groups.size(); i++) {
+			total += groups[i]->m_thrCount;
+		}
+		std::vector<size_t> bounds(1, lo);
+		size_t acc = 0;
+		for (size_t i = 0; i < groups.size(); i++) {
+			acc += groups[i]->m_thrCount;
+			bounds.push_back(lo + (hi - lo) * acc / total);
+		}
+		return bounds;
+	}
+
+	template<class Body>
+	void parallel_for(const std::vector<NUMAExecutorGroup*>& groups, const std::vector<size_t>& bounds, const Body& body, size_t grain = 0) {
+		assert(bounds.size() == groups.size() + 1);
+		detail::ForLeaf<Body> leaf(body);
+		std::vector<detail::LoopJob<detail::ForLeaf<Body> >*> jobs;
+		for (size_t i = 0; i < groups.size(); i++) {
+			jobs.push_back(new detail::LoopJob<detail::ForLeaf<Body> >(groups[i]->taskPool(), leaf, bounds[i], bounds[i + 1], grain));
+		}
+		detail::runJobs(jobs, groups);
+		for (size_t i = 0; i < jobs.size(); i++) {
+			delete jobs[i];
+		}
+	}
+
+	template<class T, class Body, class Combine>
+	T parallel_reduce(const std::vector<NUMAExecutorGroup*>& groups, const std::vector<size_t>& bounds, const T& identity, const Body& body, const Combine& combine, size_t grain = 0) {
+		assert(bounds.size() == groups.size() + 1);
+		typedef detail::GroupReduce<T, Body, Combine> group_t;
+		std::vector<group_t*> parts;
+		std::vector<detail::LoopJob<detail::ReduceLeaf<T, Body, Combine> >*> jobs;
+		for (size_t i = 0; i < groups.size(); i++) {
+			parts.push_back(new group_t(groups[i]->taskPool(), identity, body, combine, bounds[i], bounds[i + 1], grain));
+			jobs.push_back(&parts.back()->job);
+		}
+		detail::runJobs(jobs, groups);
+		T result = identity;
+		for (size_t i = 0; i < parts.size(); i++) {
+			parts[i]->slots.collect(result, combine);
+			delete parts[i];
+		}
+		return result;
+	}
+}
+
+#endif
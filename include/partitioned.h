@@ -0,0 +1,200 @@
+#ifndef _NUMA_PARTITIONED_H_
+#define _NUMA_PARTITIONED_H_
+#include "parallel.h"
+#include <type_traits>
+
+namespace Task {
+
+	// Fixed-size array spread over several groups' node-local memory. It is
+	// cut into power-of-two chunks of about CHUNK_BYTES, each allocated from
+	// its owner's memPool:
+	//  BLOCK   contiguous runs of chunks, sized by each group's thread count
+	//  CYCLIC  chunk c on group c % groups
+	// Elements are built and destroyed by their owners' workers, and
+	// forEach()/reduce() run every chunk on the group that holds it.
+	template<class T>
+	class PartitionedArray : public noncopyable {
+	public:
+		enum layout_t {
+			BLOCK = 0,
+			CYCLIC
+		};
+		static const size_t CHUNK_BYTES = 256 * 1024;
+		PartitionedArray(const std::vector<NUMAExecutorGroup*>& groups, size_t size, layout_t layout = BLOCK, const T& value = T())
+			: m_groups(groups)
+			, m_size(size)
+			, m_shift(0)
+			, m_owned(groups.size())
+		{
+			assert(!groups.empty());
+			while ((size_t(2) << m_shift) * sizeof(T) <= CHUNK_BYTES) {
+				m_shift++;
+			}
+			size_t chunks = (size + chunkSize() - 1) >> m_shift;
+			std::vector<size_t> bounds = partition(groups, 0, chunks);
+			for (size_t c = 0; c < chunks; c++) {
+				size_t g = 0;
+				if (layout == CYCLIC) {
+					g = c % groups.size();
+				} else {
+					while (c >= bounds[g + 1]) {
+						g++;
+					}
+				}
+				m_owners.push_back(g);
+				m_owned[g].push_back(c);
+			}
+			m_chunks.assign(chunks, NULL);
+			try {
+				for (size_t c = 0; c < chunks; c++) {
+					m_chunks[c] = static_cast<T*>(m_groups[m_owners[c]]->memPool()->alloc(sizeof(T) * chunkSize()));
+					if (!m_chunks[c]) {
+						throw std::bad_alloc();
+					}
+				}
+			} catch (...) {
+				freeChunks();
+				throw;
+			}
+			// first touch by the owning node's workers
+			forEach([this, &value](size_t lo, size_t hi) {
+				for (size_t i = lo; i < hi; i++) {
+					new (&(*this)[i]) T(value);
+				}
+			});
+		}
+		~PartitionedArray() {
+			if (!std::is_trivially_destructible<T>::value) {
+				forEach([this](size_t lo, size_t hi) {
+					for (size_t i = lo; i < hi; i++) {
+						(*this)[i].~T();
+					}
+				});
+			}
+			freeChunks();
+		}
+		size_t size() const {
+			return m_size;
+		}
+		T& operator[](size_t i) {
+			return m_chunks[i >> m_shift][i & (chunkSize() - 1)];
+		}
+		const T& operator[](size_t i) const {
+			return m_chunks[i >> m_shift][i & (chunkSize() - 1)];
+		}
+		// elements per chunk, ranges handed to bodies never cross a chunk
+		// boundary unless the chunks on both sides belong to the same group
+		size_t chunkSize() const {
+			return size_t(1) << m_shift;
+		}
+		// index into groups of the group holding element i
+		size_t owner(size_t i) const {
+			return m_owners[i >> m_shift];
+		}
+		// body(lo, hi) over the whole array, each range on its owner's pool
+		template<class Body>
+		void forEach(const Body& body, size_t grain = 0) {
+			typedef ChunkBody<Body, void> chunk_t;
+			typedef detail::ForLeaf<chunk_t> leaf_t;
+			std::vector<chunk_t*> bodies;
+			std::vector<leaf_t*> leaves;
+			std::vector<detail::LoopJob<leaf_t>*> jobs;
+			for (size_t g = 0; g < m_groups.size(); g++) {
+				bodies.push_back(new chunk_t(*this, m_owned[g], body));
+				leaves.push_back(new leaf_t(*bodies.back()));
+				jobs.push_back(new detail::LoopJob<leaf_t>(m_groups[g]->taskPool(), *leaves.back(), 0, m_owned[g].size(), grain ? grain : 1));
+			}
+			detail::runJobs(jobs, m_groups);
+			for (size_t g = 0; g < jobs.size(); g++) {
+				delete jobs[g];
+				delete leaves[g];
+				delete bodies[g];
+			}
+		}
+		// body(lo, hi) returns the partial result of its range, see
+		// parallel_reduce
+		template<class R, class Body, class Combine>
+		R reduce(const R& identity, const Body& body, const Combine& combine, size_t grain = 0) {
+			typedef ChunkBody<Body, R, Combine> chunk_t;
+			typedef detail::GroupReduce<R, chunk_t, Combine> group_t;
+			std::vector<chunk_t*> bodies;
+			std::vector<group_t*> parts;
+			std::vector<detail::LoopJob<detail::ReduceLeaf<R, chunk_t, Combine> >*> jobs;
+			for (size_t g = 0; g < m_groups.size(); g++) {
+				bodies.push_back(new chunk_t(*this, m_owned[g], body, &identity, &combine));
+				parts.push_back(new group_t(m_groups[g]->taskPool(), identity, *bodies.back(), combine, 0, m_owned[g].size(), grain ? grain : 1));
+				jobs.push_back(&parts.back()->job);
+			}
+			detail::runJobs(jobs, m_groups);
+			R result = identity;
+			for (size_t g = 0; g < parts.size(); g++) {
+				parts[g]->slots.collect(result, combine);
+				delete parts[g];
+				delete bodies[g];
+			}
+			return result;
+		}
+	private:
+		// Maps a range of one group's owned-chunk list to element ranges,
+		// merging chunks that are adjacent in the array.
+		template<class Body, class R, class Combine = void>
+		struct ChunkBody {
+			const PartitionedArray& array;
+			const std::vector<size_t>& chunks;
+			const Body& body;
+			const R* identity;
+			const Combine* combine;
+			ChunkBody(const PartitionedArray& a, const std::vector<size_t>& c, const Body& b, const R* id = NULL, const Combine* comb = NULL)
+				: array(a), chunks(c), body(b), identity(id), combine(comb) {}
+			R operator()(size_t lo, size_t hi) const {
+				R acc = *identity;
+				size_t k = lo;
+				while (k < hi) {
+					size_t first = chunks[k];
+					size_t last = first;
+					while (++k < hi && chunks[k] == last + 1) {
+						last++;
+					}
+					(*combine)(acc, body(first << array.m_shift, std::min(array.m_size, (last + 1) << array.m_shift)));
+				}
+				return acc;
+			}
+		};
+		template<class Body>
+		struct ChunkBody<Body, void, void> {
+			const PartitionedArray& array;
+			const std::vector<size_t>& chunks;
+			const Body& body;
+			ChunkBody(const PartitionedArray& a, const std::vector<size_t>& c, const Body& b) : array(a), chunks(c), body(b) {}
+			void operator()(size_t lo, size_t hi) const {
+				size_t k = lo;
+				while (k < hi) {
+					size_t first = chunks[k];
+					size_t last = first;
+					while (++k < hi && chunks[k] == last + 1) {
+						last++;
+					}
+					body(first << array.m_shift, std::min(array.m_size, (last + 1) << array.m_shift));
+				}
+			}
+		};
+		std::vector<NUMAExecutorGroup*> m_groups;
+		size_t m_size;
+		int m_shift;
+		std::vector<T*> m_chunks;
+		// group index per chunk
+		std::vector<size_t> m_owners;
+		// chunk indexes per group, ascending
+		std::vector<std::vector<size_t> > m_owned;
+
+		void freeChunks() {
+			for (size_t c = 0; c < m_chunks.size(); c++) {
+				if (m_chunks[c]) {
+					m_groups[m_owners[c]]->memPool()->free(m_chunks[c]);
+				}
+			}
+		}
+	};
+}
+
+#endif
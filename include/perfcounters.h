@@ -0,0 +1,90 @@
+#ifndef _NUMA_PERF_COUNTERS_H_
+#define _NUMA_PERF_COUNTERS_H_
+#include "coroutine.h"
+#include <map>
+#include <vector>
+#include <stdint.h>
+
+namespace Task {
+
+	// Hardware counters of one thread, opened with perf_event_open as a
+	// single group so all of them cover the same interval. Counters the CPU
+	// or kernel does not offer stay 0 and are missing from available().
+	// Linux only; elsewhere nothing opens.
+	class PerfCounters : public noncopyable {
+	public:
+		enum counter_t {
+			CYCLES = 0,
+			INSTRUCTIONS,
+			LLC_MISSES,
+			// last-level misses served by this node's memory, or another's
+			LOCAL_DRAM,
+			REMOTE_DRAM,
+			COUNTER_COUNT
+		};
+		struct Sample {
+			uint64_t values[COUNTER_COUNT];
+			Sample() {
+				for (int i = 0; i < COUNTER_COUNT; i++) {
+					values[i] = 0;
+				}
+			}
+			void add(const Sample& rhs) {
+				for (int i = 0; i < COUNTER_COUNT; i++) {
+					values[i] += rhs.values[i];
+				}
+			}
+			// rhs - *this, rhs being the later reading
+			Sample until(const Sample& rhs) const {
+				Sample d;
+				for (int i = 0; i < COUNTER_COUNT; i++) {
+					d.values[i] = rhs.values[i] - values[i];
+				}
+				return d;
+			}
+		};
+		PerfCounters();
+		~PerfCounters();
+		// counts the calling thread from now on, false when none opened
+		bool open();
+		void close();
+		bool opened() const {
+			return m_available != 0;
+		}
+		// bit i set when counter i is counting
+		unsigned int available() const {
+			return m_available;
+		}
+		// running totals since open(), one read syscall
+		bool read(Sample& out) const;
+		static const char* name(int counter);
+	private:
+		int m_fds[COUNTER_COUNT];
+		// read() order of the opened counters
+		int m_order[COUNTER_COUNT];
+		int m_opened;
+		unsigned int m_available;
+	};
+
+	// Counter totals of a pool, see Pool::setPerfCounters()
+	struct PerfSnapshot {
+		// counters that opened on at least one worker
+		unsigned int available;
+		PerfCounters::Sample total;
+		std::vector<PerfCounters::Sample> workers;
+		// by task function when per-task attribution is on. Inline tasks
+		// are counted under the dispatcher that ran them.
+		std::map<coroutine_func_t, PerfCounters::Sample> tasks;
+		PerfSnapshot() : available(0) {}
+		void merge(const PerfSnapshot& rhs) {
+			available |= rhs.available;
+			total.add(rhs.total);
+			workers.insert(workers.end(), rhs.workers.begin(), rhs.workers.end());
+			for (std::map<coroutine_func_t, PerfCounters::Sample>::const_iterator i = rhs.tasks.begin(); i != rhs.tasks.end(); ++i) {
+				tasks[i->first].add(i->second);
+			}
+		}
+	};
+}
+
+#endif
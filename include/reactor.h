@@ -0,0 +1,125 @@
+#ifndef _NUMA_REACTOR_H_
+#define _NUMA_REACTOR_H_
+#include "coroutine.h"
+#include "sync.h"
+#include "context.h"
+#include <deque>
+#include <map>
+#include <queue>
+#include <vector>
+#ifndef _WIN32
+#include <sys/types.h>
+#include <sys/socket.h>
+#endif
+
+namespace Task {
+	// One Reactor per worker thread, only polled by its owner.
+	// On Linux read/write/accept go through io_uring when the kernel supports
+	// it and fall back to epoll readiness otherwise, or when NUMA_NO_IO_URING
+	// is set in the environment. notify() may be called from any thread.
+	class Reactor : public noncopyable {
+	public:
+		enum backend_t {
+			EPOLL = 0,
+			IO_URING = 1
+		};
+		Reactor(bool useUring = true);
+		~Reactor();
+		backend_t backend() const {
+			return m_backend;
+		}
+		// wake the owning worker out of poll(), callable from any thread
+		void notify();
+		// wait up to timeoutMs (-1 = forever) for I/O, timers or notify(),
+		// coroutines whose operation completed are appended to ready
+		void poll(int timeoutMs, coroutineListType& ready);
+		bool pending() const {
+			return m_pending > 0;
+		}
+
+		// the following suspend the running coroutine, owning worker only
+#ifndef _WIN32
+		ssize_t read(int fd, void* buf, size_t len, off_t offset = -1);
+		ssize_t write(int fd, const void* buf, size_t len, off_t offset = -1);
+		int accept(int fd, sockaddr* addr, socklen_t* addrlen);
+#endif
+		void sleep(int ms);
+	private:
+		struct Request {
+			coroutine* co;
+			long long result;
+		};
+		struct Timer {
+			long long deadline;
+			unsigned long long seq;
+			coroutine* co;
+			bool operator<(const Timer& rhs) const {
+				if (deadline != rhs.deadline) {
+					return deadline > rhs.deadline;
+				}
+				return seq > rhs.seq;
+			}
+		};
+		backend_t m_backend;
+		int m_pending;
+		unsigned long long m_timerSeq;
+		std::priority_queue<Timer> m_timers;
+
+		void suspend(coroutine* co);
+		int nextTimeout(int timeoutMs) const;
+		void expireTimers(coroutineListType& ready);
+		static long long now();
+
+#ifdef _WIN32
+		sys::Semaphore m_wakeup;
+#else
+		struct FdWait {
+			coroutineListType readers;
+			coroutineListType writers;
+		};
+		int m_epollFd;
+		int m_eventFd;
+		std::map<int, FdWait> m_fdWaits;
+
+		bool waitFd(int fd, bool write);
+		static unsigned int interest(const FdWait& w);
+		void dispatchFd(int fd, unsigned int events, coroutineListType& ready);
+
+		// raw io_uring syscalls, no liburing dependency
+		struct Uring {
+			int fd;
+			unsigned int entries;
+			unsigned int cqEntries;
+			unsigned int inflight;
+			unsigned int toSubmit;
+			unsigned int *sqHead, *sqTail, *sqMask, *sqArray;
+			unsigned int *cqHead, *cqTail, *cqMask;
+			void *sqRing, *cqRing, *sqes, *cqes;
+			size_t sqRingSize, cqRingSize, sqesSize;
+		} m_ring;
+
+		bool setupUring();
+		void closeUring();
+		bool uringAvailable();
+		bool uringFull() const;
+		long long uringCall(int op, int fd, void* addr, unsigned int len, unsigned long long off, unsigned long long addr2);
+		void uringSubmit();
+		void uringReap(coroutineListType& ready);
+#endif
+	};
+
+	extern ContextLocal<Reactor*, &WorkerContext::reactor> curReactor;
+
+	// inside a worker these suspend the coroutine on the worker's Reactor,
+	// anywhere else they are plain blocking calls
+	namespace io {
+#ifndef _WIN32
+		ssize_t read(int fd, void* buf, size_t len, off_t offset = -1);
+		ssize_t write(int fd, const void* buf, size_t len, off_t offset = -1);
+		int accept(int fd, sockaddr* addr = 0, socklen_t* addrlen = 0);
+#endif
+		void sleep(int ms);
+	}
+}
+
+#endif
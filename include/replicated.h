@@ -0,0 +1,183 @@
+#ifndef _NUMA_REPLICATED_H_
+#define _NUMA_REPLICATED_H_
+#include "NUMAExecutorGroup.h"
+#include <atomic>
+#include <vector>
+#include <utility>
+
+namespace Task {
+
+	// A read-mostly value copied into every node's memPool, so that reads
+	// stay on the reader's node. Threads outside any group read the first
+	// group's copy. Only T itself is placed; whatever it allocates on its
+	// own, a std::vector's buffer say, comes from wherever its allocator
+	// takes it.
+	//
+	// Updates are RCU style: the change is applied once, then a fresh copy
+	// is published to each node and the old one freed once the readers that
+	// may still see it are done. Readers never lock or wait; they only bump
+	// a counter on their own node's replica.
+	template<class T>
+	class NodeReplicated : public noncopyable {
+	public:
+		// one replica per NUMA node among groups, the first group seen on a
+		// node provides its memory
+		NodeReplicated(NUMAExecutorGroup* const* groups, int count, const T& value = T())
+			: m_home(NULL)
+			, m_master(value)
+		{
+			assert(count > 0);
+			for (int i = 0; i < count; i++) {
+				size_t node = size_t(groups[i]->m_NUMANode);
+				if (node >= m_replicas.size()) {
+					m_replicas.resize(node + 1, NULL);
+				}
+				if (!m_replicas[node]) {
+					m_replicas[node] = Replica::create(groups[i]->memPool(), value);
+				}
+				if (!m_home) {
+					m_home = m_replicas[node];
+				}
+			}
+		}
+		// no reads or updates may be running
+		~NodeReplicated() {
+			for (size_t i = 0; i < m_replicas.size(); i++) {
+				if (m_replicas[i]) {
+					Replica::destroy(m_replicas[i]);
+				}
+			}
+		}
+		// f(const T&) on the caller's node copy, returning what f returns.
+		// Updates wait for running reads, so f should not block or park.
+		template<class F>
+		auto read(F f) const -> decltype(f(std::declval<const T&>())) {
+			Replica* r = local();
+			ReadGuard guard(r);
+			return f(*guard.value);
+		}
+		// copy of the caller's node replica
+		T get() const {
+			Replica* r = local();
+			ReadGuard guard(r);
+			return *guard.value;
+		}
+		// f(T&) edits the value once, then every node gets a copy. Updates are
+		// serialized; readers see the old or the new value, never a mix.
+		template<class F>
+		void update(F f) {
+			lock_guard<sys::Mutex> _(m_writeLock);
+			f(m_master);
+			for (size_t i = 0; i < m_replicas.size(); i++) {
+				if (m_replicas[i]) {
+					m_replicas[i]->publish(m_master);
+				}
+			}
+		}
+		void set(const T& value) {
+			update([&value](T& v) { v = value; });
+		}
+	private:
+		struct Replica {
+			std::atomic<T*> value;
+			// parity selects the readers counter new reads register on
+			std::atomic<unsigned int> epoch;
+			memPoolType* pool;
+			char pad[CACHE_LINE_SIZE];
+			std::atomic<long> readers[2];
+
+			static Replica* create(memPoolType* pool, const T& v) {
+				void* mem = pool->alloc(sizeof(Replica));
+				if (!mem) {
+					throw std::bad_alloc();
+				}
+				Replica* r = new (mem) Replica;
+				r->pool = pool;
+				r->epoch.store(0, std::memory_order_relaxed);
+				r->readers[0].store(0, std::memory_order_relaxed);
+				r->readers[1].store(0, std::memory_order_relaxed);
+				r->value.store(r->copy(v), std::memory_order_release);
+				return r;
+			}
+			static void destroy(Replica* r) {
+				memPoolType* pool = r->pool;
+				r->release(r->value.load(std::memory_order_relaxed));
+				r->~Replica();
+				pool->free(r);
+			}
+			T* copy(const T& v) {
+				void* mem = pool->alloc(sizeof(T));
+				if (!mem) {
+					throw std::bad_alloc();
+				}
+				try {
+					return new (mem) T(v);
+				} catch (...) {
+					pool->free(mem);
+					throw;
+				}
+			}
+			void release(T* v) {
+				v->~T();
+				pool->free(v);
+			}
+			// Swaps in a copy of v, then flips the epoch and waits for the
+			// reads registered under the old one, the only ones that may
+			// still hold the old copy. Writers are serialized by the caller.
+			void publish(const T& v) {
+				T* old = value.exchange(copy(v), std::memory_order_seq_cst);
+				unsigned int e = epoch.fetch_add(1, std::memory_order_seq_cst);
+				std::atomic<long>& prev = readers[e & 1];
+				for (int spins = 0; prev.load(std::memory_order_seq_cst) != 0; spins++) {
+					if (spins < SPIN_COUNT) {
+						sys::cpuRelax();
+					} else {
+						sys::yieldThread();
+					}
+				}
+				release(old);
+			}
+		};
+		// registers on the replica's current epoch for as long as it lives
+		struct ReadGuard {
+			std::atomic<long>* readers;
+			const T* value;
+			explicit ReadGuard(Replica* r) {
+				for (;;) {
+					unsigned int e = r->epoch.load(std::memory_order_seq_cst);
+					readers = &r->readers[e & 1];
+					readers->fetch_add(1, std::memory_order_seq_cst);
+					// a flip in between means the writer may not wait for us
+					if (r->epoch.load(std::memory_order_seq_cst) == e) {
+						break;
+					}
+					readers->fetch_sub(1, std::memory_order_release);
+				}
+				value = r->value.load(std::memory_order_seq_cst);
+			}
+			~ReadGuard() {
+				readers->fetch_sub(1, std::memory_order_release);
+			}
+		};
+		static const int SPIN_COUNT = 256;
+		// indexed by NUMA node, NULL where no group was given
+		std::vector<Replica*> m_replicas;
+		Replica* m_home;
+		// the value updates are applied to, off every node's hot path
+		T m_master;
+		sys::Mutex m_writeLock;
+
+		Replica* local() const {
+			NUMAExecutorGroup* eg = curExecutorGroup.get();
+			if (eg) {
+				size_t node = size_t(eg->m_NUMANode);
+				if (node < m_replicas.size() && m_replicas[node]) {
+					return m_replicas[node];
+				}
+			}
+			return m_home;
+		}
+	};
+}
+
+#endif
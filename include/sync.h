@@ -1,16 +1,21 @@
 #ifndef _NUMA_SYNC_H_
 #define _NUMA_SYNC_H_
 #include <mutex>
+#include <atomic>
 #include "coroutine.h"
 #include <deque>
 #ifdef _WIN32
 #include <Windows.h>
 #else
 #include <pthread.h>
+#include <sched.h>
 #include <semaphore.h>
+#include <time.h>
+#include <errno.h>
 #endif
 
 namespace Task {
+	class Pool;
 
 	namespace sys {
 		class Mutex : public noncopyable {
@@ -61,6 +66,8 @@ namespace Task {
 			Semaphore(int initval = 0);
 			void up(int val = 1);
 			void down();
+			// false on timeout
+			bool timedDown(int ms);
 		private:
 #ifdef _WIN32
 			HANDLE m_semaphore;
@@ -79,6 +86,9 @@ namespace Task {
 		inline void Semaphore::down() {
 			::WaitForSingleObject(m_semaphore, INFINITE);
 		}
+		inline bool Semaphore::timedDown(int ms) {
+			return ::WaitForSingleObject(m_semaphore, ms < 0 ? INFINITE : DWORD(ms)) == WAIT_OBJECT_0;
+		}
 #else
 		inline Semaphore::Semaphore(int initval) {
 			sem_init(&m_semaphore, 0, initval);
@@ -91,7 +101,43 @@ namespace Task {
 		inline void Semaphore::down() {
 			sem_wait(&m_semaphore);
 		}
+		inline bool Semaphore::timedDown(int ms) {
+			if (ms < 0) {
+				down();
+				return true;
+			}
+			timespec ts;
+			clock_gettime(CLOCK_REALTIME, &ts);
+			ts.tv_sec += ms / 1000;
+			ts.tv_nsec += (ms % 1000) * 1000000L;
+			if (ts.tv_nsec >= 1000000000L) {
+				ts.tv_sec++;
+				ts.tv_nsec -= 1000000000L;
+			}
+			while (sem_timedwait(&m_semaphore, &ts) != 0) {
+				if (errno != EINTR) {
+					return false;
+				}
+			}
+			return true;
+		}
+#endif
+		// busy-wait hint for spin loops
+		inline void cpuRelax() {
+#ifdef _WIN32
+			YieldProcessor();
+#elif defined(__x86_64__) || defined(__i386__)
+			__builtin_ia32_pause();
+#endif
+		}
+		// gives the CPU to another runnable thread, for waits that outlast a spin
+		inline void yieldThread() {
+#ifdef _WIN32
+			::SwitchToThread();
+#else
+			sched_yield();
 #endif
+		}
 	}
 	template<class lock>
 	class lock_guard : public noncopyable {
@@ -106,20 +152,29 @@ namespace Task {
 		lock& m_mtx;
 	};
 
-	typedef std::deque<coroutine*> coroutineListType;
+	typedef IntrusiveList<coroutine> coroutineListType;
+	// Semaphore, Event and Barrier keep their state in one atomic word. The
+	// mutex only guards the wait queue, so calls that neither wait nor find
+	// anybody waiting get by with a CAS.
 	class Semaphore : public noncopyable {
 	public:
 		Semaphore(int initVal = 0);
 		void down(int count);
-		void up();
+		// wakes every waiter, in order, that the new count covers
+		void up(int count = 1);
 	private:
+		// m_state is the count times UNIT plus the WAITING bit
+		enum { WAITING = 1, UNIT = 2 };
+		std::atomic<int> m_state;
 		sys::Mutex m_lock;
-		volatile int m_cnt;
-		struct waitItem {
+		// lives on the waiting coroutine's stack
+		struct waitItem : public ListHook {
 			int need;
 			coroutine* co;
+			Semaphore* sem;
 		};
-		std::deque<waitItem> m_waitQueue;
+		IntrusiveList<waitItem> m_waitQueue;
+		static void s_parkWaiter(void* ctx);
 	};
 
 	class Event : public noncopyable {
@@ -128,9 +183,16 @@ namespace Task {
 		void signal();
 		void wait();
 	private:
-		bool m_status;
+		// never both at once
+		enum { SIGNALED = 1, WAITING = 2 };
+		std::atomic<int> m_state;
 		sys::Mutex m_lock;
 		coroutineListType m_waitQueue;
+		struct waitItem {
+			coroutine* co;
+			Event* event;
+		};
+		static void s_parkWaiter(void* ctx);
 	};
 
 	class Barrier : public noncopyable {
@@ -138,10 +200,90 @@ namespace Task {
 		Barrier(int waitCount = 1);
 		void sync();
 	private:
-		int m_cnt;
+		// generation in the high half, bumped on every release, arrivals
+		// of that generation in the low half
+		std::atomic<unsigned long long> m_state;
 		int m_trigger;
+		sys::Mutex m_lock;
+		struct waitItem : public ListHook {
+			coroutine* co;
+			Barrier* barrier;
+			unsigned int generation;
+		};
+		IntrusiveList<waitItem> m_waitQueue;
+		static void s_parkWaiter(void* ctx);
+	};
+
+	// The locks below suspend the coroutine instead of the worker. An
+	// uncontended lock is a single CAS; a contended one spins briefly, then
+	// parks, and unlock hands the lock straight to the first waiter.
+	class Mutex : public noncopyable {
+	public:
+		Mutex();
+		void lock();
+		bool tryLock();
+		void unlock();
+	private:
+		enum { UNLOCKED = 0, LOCKED = 1, CONTENDED = 2 };
+		std::atomic<int> m_state;
+		sys::Mutex m_lock;
+		coroutineListType m_waitQueue;
+		struct waitItem {
+			coroutine* co;
+			Mutex* mutex;
+		};
+		static void s_parkWaiter(void* ctx);
+	};
+
+	// Readers share, writers are exclusive. Once anybody waits new readers
+	// queue up behind them, so writers are not starved.
+	class SharedMutex : public noncopyable {
+	public:
+		SharedMutex();
+		void lock();
+		bool tryLock();
+		void unlock();
+		void lockShared();
+		bool tryLockShared();
+		void unlockShared();
+	private:
+		// m_state holds the WRITER and WAITING bits plus READER per reader
+		enum { WRITER = 1, WAITING = 2, READER = 4 };
+		std::atomic<int> m_state;
+		sys::Mutex m_lock;
+		struct waitItem : public ListHook {
+			coroutine* co;
+			SharedMutex* mutex;
+			bool shared;
+		};
+		IntrusiveList<waitItem> m_waitQueue;
+		void park(bool shared);
+		void release(int held);
+		void wake();
+		static void s_parkWaiter(void* ctx);
+	};
+
+	class ConditionVariable : public noncopyable {
+	public:
+		// m must be held. It is released while waiting and held again on return.
+		void wait(Mutex& m);
+		template<class Pred>
+		void wait(Mutex& m, Pred pred) {
+			while (!pred()) {
+				wait(m);
+			}
+		}
+		void notifyOne();
+		void notifyAll();
+	private:
 		sys::Mutex m_lock;
 		coroutineListType m_waitQueue;
+		struct waitItem {
+			coroutine* co;
+			ConditionVariable* cond;
+			Mutex* mutex;
+		};
+		static void s_parkWaiter(void* ctx);
 	};
 }
 
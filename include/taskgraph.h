@@ -0,0 +1,55 @@
+#ifndef _NUMA_TASK_GRAPH_H_
+#define _NUMA_TASK_GRAPH_H_
+#include "future.h"
+#include <vector>
+
+namespace Task {
+
+	// A DAG of tasks that is built once and can be run any number of times.
+	// Every node keeps an atomic count of unfinished predecessors. Whoever
+	// finishes last releases the successor: the first released successor
+	// continues on the same coroutine, the others go to the local worker
+	// queue. Pending edges never park a coroutine.
+	class TaskGraph : public noncopyable {
+	public:
+		typedef size_t node_t;
+		TaskGraph();
+		~TaskGraph();
+		// group pins the node to that group's pool, by default it runs on
+		// the pool passed to start()
+		node_t addNode(coroutine_func_t func, void* ud, NUMAExecutorGroup* group = NULL);
+		// to starts only once from has finished
+		void addEdge(node_t from, node_t to);
+		size_t size() const {
+			return m_nodes.size();
+		}
+		// one run at a time; returns an invalid Future if the graph has a cycle
+		Future<void> start(Pool& pool);
+		// start() and wait, false if the graph has a cycle
+		bool run(Pool& pool);
+	private:
+		struct Node : public NodeLocal {
+			coroutine_func_t func;
+			void* ud;
+			Pool* pool;
+			TaskGraph* graph;
+			int preds;
+			std::atomic<int> pending;
+			std::vector<Node*> succ;
+		};
+		std::vector<Node*> m_nodes;
+		std::vector<Node*> m_roots;
+		bool m_dirty;
+		bool m_acyclic;
+		Pool* m_pool;
+		std::atomic<size_t> m_remaining;
+		Promise<void>* m_done;
+
+		bool validate();
+		void submit(Node* n, Pool* target);
+		void finish();
+		static void s_node(void* ud);
+	};
+}
+
+#endif
@@ -10,35 +10,115 @@
 #include <iostream>
 #include "thread.h"
 #include "sync.h"
+#include "reactor.h"
+#include "context.h"
+#include "trace.h"
+#include "metrics.h"
+#include "perfcounters.h"
 #include <atomic>
 
 namespace Task {
-	typedef std::deque<coroutine*> coroutineListType;
 
 class Pool;
 
-extern ThreadLocal<Pool*> curPool;
-extern ThreadLocal<coroutine_schedule*> curSchedule;
-extern ThreadLocal<size_t> curThreadId;
+extern ContextLocal<Pool*, &WorkerContext::pool> curPool;
+extern ContextLocal<coroutine_schedule*, &WorkerContext::schedule> curSchedule;
+extern ContextLocal<size_t, &WorkerContext::threadId> curThreadId;
+
+namespace detail {
+	// node-local blocks for closures too large for the coroutine, from
+	// group's memPool or the caller's when group is NULL
+	void* allocClosure(NUMAExecutorGroup* group, size_t size);
+	void freeClosure(void* p);
+	// Task function of a closure added with Pool::addTask(F). The callable
+	// lives in the coroutine's closure buffer when it fits, otherwise in a
+	// node-local block with ud pointing at it.
+	template<class Fn>
+	struct Closure {
+		static const bool INPLACE = sizeof(Fn) <= coroutine::CLOSURE_SIZE
+			&& std::alignment_of<Fn>::value <= std::alignment_of<std::aligned_storage<coroutine::CLOSURE_SIZE>::type>::value;
+		static void s_run(void* ud) {
+			Fn* f = reinterpret_cast<Fn*>(INPLACE ? curSchedule.get()->running()->closure() : ud);
+			(*f)();
+			f->~Fn();
+			if (!INPLACE) {
+				freeClosure(f);
+			}
+		}
+	};
+	// keeps addTask(F) away from the function pointer and coroutine overloads
+	template<class F>
+	struct IsClosure {
+		static const bool value = !std::is_convertible<F, coroutine_func_t>::value
+			&& !std::is_convertible<F, coroutine*>::value;
+	};
+}
 
 class Pool {
 public:
 	typedef void(*thread_init_t)(void*, int);
 	typedef lock_guard<sys::Mutex> scoped_lock;
-	Pool(int maxThread = 4, KAFFINITY affinityMask = 0xf, thread_init_t init_func = 0, void * ctx = 0)
-		: m_Exit(false)
+	static const size_t DEFAULT_COROUTINE_CACHE = 64;
+	enum wake_policy_t {
+		// back onto the worker it last ran on
+		WAKE_HOME = 0,
+		// onto the waking worker when that is one of ours
+		WAKE_WAKER
+	};
+	// what a submission past the admission limit does, see setAdmission()
+	enum overload_policy_t {
+		// fails
+		OVERLOAD_REJECT = 0,
+		// waits for room: the submitting coroutine is suspended, a thread
+		// outside any pool blocks
+		OVERLOAD_WAIT,
+		// subtasks from the pool's own workers still get in, up to twice
+		// the limit, so admitted work can finish; new work from outside fails
+		OVERLOAD_SHED
+	};
+	// maxThread workers are started right away, setElastic() lets the
+	// idle ones retire. numaNode >= 0 places coroutines and their stacks
+	// on that node.
+	Pool(int maxThread = 4, KAFFINITY affinityMask = 0xf, thread_init_t init_func = 0, void * ctx = 0, int numaNode = -1)
+		: m_tasks(maxThread)
+		, m_inline(maxThread)
+		, m_dispatchers(maxThread)
+		, m_state(maxThread)
+		, m_parked(maxThread)
+		, m_busyPoll(false)
+		, m_perfMode(PERF_OFF)
+		, m_localFree(maxThread)
+		, m_freeCap(DEFAULT_COROUTINE_CACHE)
+		, m_numaNode(numaNode)
+		, m_group(NULL)
+		, m_Exit(false)
 		, m_threadCount(maxThread)
-		, m_index(0)
+		, m_active(0)
 		, m_curIdx(0)
 		, m_threadInit(init_func)
 		, m_ctx(ctx)
+		, m_minThreads(maxThread)
+		, m_growDepth(0)
+		, m_growTicks(0)
+		, m_retireTicks(0)
+		, m_retireMs(-1)
+		, m_pressureSince(0)
+		, m_live(0)
+		, m_admitLimit(0)
+		, m_overload(OVERLOAD_REJECT)
+		, m_roomWaiting(0)
+		, m_draining(false)
+		, m_wakePolicy(WAKE_HOME)
 	{
 		assert(maxThread > 0);
-		m_tasks.resize(maxThread);
 		int CPUIdx = 0;
 		for(int i=0; i<maxThread; i++) {
 			m_lock.push_back(new sys::Mutex);
-			m_sem.push_back(new sys::Semaphore);
+			m_reactors.push_back(new Reactor);
+			m_perf.push_back(new PerfWorker);
+		}
+		for(int i=0; i<=maxThread; i++) {
+			m_stats.push_back(new WorkerStats);
 		}
 		for(int i=0; i<maxThread; i++) {
 			KAFFINITY mask = 1;
@@ -47,153 +127,954 @@ public:
 			}
 			mask <<= CPUIdx;
 			CPUIdx++;
-			m_threads.push_back(new Thread(s_routine, this, coroutine_schedule::STACK_SIZE, mask));
+			WorkerSlot slot = { this, i, mask };
+			m_slots.push_back(slot);
+		}
+		m_threads.resize(maxThread, NULL);
+		scoped_lock _(m_scaleLock);
+		for(int i=0; i<maxThread; i++) {
+			start(i);
 		}
 	}
 	~Pool() {
 		join();
-		for(size_t i=0; i<m_threads.size(); i++) {
-			delete m_threads[i];
+		for(size_t i=0; i<m_reactors.size(); i++) {
+			delete m_reactors[i];
 		}
-	}
-	static void checkSemp(coroutineListType& list, sys::Semaphore& sem) {
-		if (list.empty()) {
-			sem.up();
+		for(size_t i=0; i<m_stats.size(); i++) {
+			delete m_stats[i];
+		}
+		for(size_t i=0; i<m_perf.size(); i++) {
+			delete m_perf[i];
 		}
+		for(size_t i=0; i<m_localFree.size(); i++) {
+			freeAll(m_localFree[i].items);
+			freeAll(m_localFree[i].inlineTasks);
+			freeAll(m_inline[i]);
+		}
+		freeAll(m_freeRoutines);
 	}
+	// Submission is safe from any thread, inside the pool or not.
 	bool addTask(coroutine_func_t func, void * ud, int targetIdx = -1) {
-		coroutine* task = getCoroutine(func, ud);
-		try {
-			unsigned int idx;
-			if (targetIdx != -1)
-				idx = targetIdx;
-			else
-				idx = m_curIdx.fetch_add(1);
-			scoped_lock lock(*m_lock[idx % m_threadCount]);
-			checkSemp(m_tasks[idx % m_threadCount], *m_sem[idx % m_threadCount]);
-			m_tasks[idx % m_threadCount].push_back(task);
-			return true;
-		} catch(...) {
+		if (!admit()) {
 			return false;
 		}
+		return enqueue(getCoroutine(func, ud), targetIdx, false);
 	}
 	bool addTask(coroutine* co, int targetIdx = -1) {
-		try {
-			unsigned int idx;
-			if (targetIdx != -1)
-				idx = targetIdx;
-			else
-				idx = m_curIdx.fetch_add(1);
-			scoped_lock lock(*m_lock[idx % m_threadCount]);
-			checkSemp(m_tasks[idx % m_threadCount], *m_sem[idx % m_threadCount]);
-			m_tasks[idx % m_threadCount].push_back(co);
-			return true;
-		} catch(...) {
+		if (co->status() == coroutine::READY && !admit()) {
 			return false;
 		}
+		return enqueue(co, targetIdx, false);
+	}
+	// f() runs as a task of its own. Its captures are moved into the
+	// coroutine, only ones larger than coroutine::CLOSURE_SIZE are allocated,
+	// from the node-local memPool of the pool's group.
+	template<class F>
+	bool addTask(F&& f, int targetIdx = -1, typename std::enable_if<detail::IsClosure<F>::value>::type* = 0) {
+		if (!admit()) {
+			return false;
+		}
+		return enqueue(closureTask(std::forward<F>(f)), targetIdx, false);
+	}
+	// Submits work a task of this pool only relays, such as a Handoff drain
+	// passing on what other groups sent. The relaying task's own slot does
+	// not count against the admission limit, and past it the call fails
+	// instead of waiting, whatever the overload policy.
+	bool addRelayedTask(coroutine_func_t func, void * ud, int targetIdx = -1) {
+		if (!admitRelayed()) {
+			return false;
+		}
+		return enqueue(getCoroutine(func, ud), targetIdx, false);
+	}
+	template<class F>
+	bool addRelayedTask(F&& f, int targetIdx = -1, typename std::enable_if<detail::IsClosure<F>::value>::type* = 0) {
+		if (!admitRelayed()) {
+			return false;
+		}
+		return enqueue(closureTask(std::forward<F>(f)), targetIdx, false);
 	}
 	bool addImmediatelyTask(coroutine_func_t func, void * ud, int targetIdx = -1) {
-		coroutine* task = getCoroutine(func, ud);
-		try {
-			unsigned int idx;
-			if (targetIdx != -1)
-				idx = targetIdx;
-			else
-				idx = m_curIdx.fetch_add(1);
-			scoped_lock lock(*m_lock[idx % m_threadCount]);
-			checkSemp(m_tasks[idx % m_threadCount], *m_sem[idx % m_threadCount]);
-			m_tasks[idx % m_threadCount].push_front(task);
-			return true;
-		} catch(...) {
+		if (!admit()) {
 			return false;
 		}
+		return enqueue(getCoroutine(func, ud), targetIdx, true);
 	}
 	bool addImmediatelyTask(coroutine* co, int targetIdx = -1) {
-		try {
-			unsigned int idx;
-			if (targetIdx != -1)
-				idx = targetIdx;
-			else
-				idx = m_curIdx.fetch_add(1);
-			scoped_lock lock(*m_lock[idx % m_threadCount]);
-			checkSemp(m_tasks[idx % m_threadCount], *m_sem[idx % m_threadCount]);
-			m_tasks[idx % m_threadCount].push_front(co);
-			return true;
-		} catch(...) {
+		if (co->status() == coroutine::READY && !admit()) {
 			return false;
 		}
+		return enqueue(co, targetIdx, true);
 	}
+	// Requeues a batch of suspended coroutines, emptying cos, with a single
+	// queue lock. Idle workers are woken to steal from the batch.
+	void addImmediatelyTasks(coroutineListType& cos, int targetIdx = -1) {
+		size_t n = cos.size();
+		if (!n) {
+			return;
+		}
+		unsigned long long now = Trace::timestamp();
+		for(coroutine* co = cos.front(); co; co = coroutineListType::next(co)) {
+			co->setQueuedAt(now);
+			NUMA_TRACE_EVENT(SUBMIT, co);
+		}
+		unsigned int slot = lockSlot(targetIdx != -1 ? targetIdx : m_curIdx.fetch_add(1));
+		m_tasks[slot].splice_front(cos);
+		size_t depth = m_tasks[slot].size() + m_inline[slot].size();
+		m_lock[slot]->unlock();
+		for(size_t i=0; i<n && i<size_t(m_threadCount); i++) {
+			notifyParked((slot + i) % m_threadCount);
+		}
+		if (depth >= m_growDepth && elastic()) {
+			notePressure();
+		}
+	}
+	// Runs func(ud) straight from the worker's dispatch loop, without a
+	// coroutine of its own or a context switch per task. Meant for leaf
+	// work that does not wait: should it block or yield anyway, the loop's
+	// coroutine is left to it and the worker starts a new loop.
+	bool addInlineTask(coroutine_func_t func, void * ud, int targetIdx = -1) {
+		if (!admit()) {
+			return false;
+		}
+		pushInline(func, ud, targetIdx);
+		return true;
+	}
+	// Work spawned on behalf of a task that is already in: loop pieces,
+	// future continuations, graph successors. It counts as pending like any
+	// task but is never refused, neither by the admission limit nor while
+	// draining, since somebody is waiting for it to finish.
+	void addContinuation(coroutine_func_t func, void * ud, int targetIdx = -1) {
+		m_live.fetch_add(1);
+		enqueue(getCoroutine(func, ud), targetIdx, false);
+	}
+	void addInlineContinuation(coroutine_func_t func, void * ud, int targetIdx = -1) {
+		m_live.fetch_add(1);
+		pushInline(func, ud, targetIdx);
+	}
+	// Stops the workers as soon as they finish their current task. Queued
+	// and parked tasks are abandoned, use drain() to let them finish.
 	void join() {
-		m_Exit = true;
+		std::vector<Thread*> threads;
+		{
+			scoped_lock _(m_scaleLock);
+			m_Exit = true;
+			threads.swap(m_threads);
+		}
+		for(int i=0; i<m_threadCount; i++) {
+			m_reactors[i]->notify();
+		}
+		for(size_t i=0; i<threads.size(); i++) {
+			if (threads[i]) {
+				threads[i]->join();
+				delete threads[i];
+			}
+		}
+	}
+	// Graceful shutdown: new tasks from outside the pool are refused, and
+	// the workers stop once every task has finished, parked ones included,
+	// so they must all be able to complete. Tasks may keep spawning
+	// subtasks meanwhile. Returns false when timeoutMs ran out first, the
+	// pool is stopped either way. Not for use from the pool's own workers.
+	bool drain(int timeoutMs = -1) {
+		assert(curPool.get() != this);
+		m_draining.store(true);
+		bool done = true;
+		if (m_live.load() != 0) {
+			done = m_drained.timedDown(timeoutMs);
+		}
+		join();
+		return done;
+	}
+	// Lets the worker count float between minThreads and the count given to
+	// the constructor. A worker retires after retireAfterMs without work;
+	// a new one starts when submissions keep finding growDepth or more
+	// tasks queued for growAfterMs. A retiring worker first waits out its
+	// pending I/O and timers.
+	void setElastic(int minThreads, unsigned int growDepth = 16, int growAfterMs = 2, int retireAfterMs = 1000) {
+		assert(minThreads > 0 && minThreads <= m_threadCount);
+		double ticksPerMs = Trace::ticksPerUs() * 1000.0;
+		m_growDepth = growDepth;
+		m_growTicks = (unsigned long long)(growAfterMs * ticksPerMs);
+		m_retireTicks = (unsigned long long)(retireAfterMs * ticksPerMs);
+		m_retireMs = retireAfterMs;
+		m_minThreads.store(minThreads);
+		// parked workers re-arm their idle timeout
+		for(int i=0; i<m_threadCount; i++) {
+			m_reactors[i]->notify();
+		}
+	}
+	// Finished coroutines are kept for reuse, up to perWorker on each
+	// worker and as many again in a list shared with outside submitters.
+	// Workers free the ones they did not need during an idle interval.
+	void setCoroutineCache(size_t perWorker) {
+		m_freeCap.store(perWorker, std::memory_order_relaxed);
+	}
+	// Caps the tasks submitted and not finished yet, each of which holds a
+	// coroutine and its stack, at limit; 0 lifts the cap. Wakeups and
+	// continuations are never refused. With OVERLOAD_WAIT, tasks that wait
+	// for subtasks of their own pool can deadlock it once it is full.
+	void setAdmission(size_t limit, overload_policy_t policy = OVERLOAD_REJECT) {
+		m_overload = policy;
+		m_admitLimit.store(long(limit));
+		while (m_roomWaiting.load() && hasRoom()) {
+			wakeRoomWaiter();
+		}
+	}
+	// tasks submitted and not finished yet
+	size_t pending() const {
+		return size_t(m_live.load(std::memory_order_relaxed));
+	}
+	// pending tasks over the admission limit, 1 and up means submissions
+	// are being refused or held back. 0 without a limit.
+	double pressure() const {
+		long limit = m_admitLimit.load(std::memory_order_relaxed);
+		return limit ? double(m_live.load(std::memory_order_relaxed)) / limit : 0.0;
+	}
+	// Reads the workers' hardware counters around every resume and adds
+	// them up per worker, and with perTask also per task function. That is
+	// a read syscall per switch, so leave it off unless measuring.
+	void setPerfCounters(bool on, bool perTask = false) {
+		m_perfMode.store(on ? (perTask ? PERF_TASKS : PERF_ON) : PERF_OFF);
+	}
+	void perfSnapshot(PerfSnapshot& out) const {
+		out = PerfSnapshot();
+		out.workers.resize(m_threadCount);
 		for(int i=0; i<m_threadCount; i++) {
-			m_sem[i]->up(m_threadCount);
+			const PerfWorker& w = *m_perf[i];
+			scoped_lock _(w.lock);
+			out.available |= w.available;
+			out.workers[i] = w.total;
+			out.total.add(w.total);
+			for(std::map<coroutine_func_t, PerfCounters::Sample>::const_iterator t = w.tasks.begin(); t != w.tasks.end(); ++t) {
+				out.tasks[t->first].add(t->second);
+			}
 		}
+	}
+	// the group whose memPool holds closures spilled by addTask(F)
+	void setGroup(NUMAExecutorGroup* group) {
+		m_group = group;
+	}
+	// Dedicated-core mode: idle workers spin on their queues instead of
+	// sleeping in the reactor, polling pending I/O and timers without
+	// blocking, so a submission is picked up without any wake syscall.
+	// Busy workers do not retire when the pool is elastic.
+	void setBusyPoll(bool on) {
+		m_busyPoll.store(on);
+		// sleeping workers start spinning
 		for(int i=0; i<m_threadCount; i++) {
-			m_threads[i]->join();
+			m_reactors[i]->notify();
+		}
+	}
+	// where woken coroutines go, see wake()
+	void setWakePolicy(wake_policy_t policy) {
+		m_wakePolicy = policy;
+	}
+	// Makes a suspended coroutine runnable again in the pool it last ran
+	// in. Like the add functions it may be called from any thread.
+	static void wake(coroutine* co) {
+		Pool* pool = co->home();
+		pool->addImmediatelyTask(co, pool->wakeTarget(co->homeWorker()));
+	}
+	// wakes cos, emptying it, with one submission per target worker
+	static void wakeAll(coroutineListType& cos) {
+		while (!cos.empty()) {
+			coroutine* first = cos.front();
+			Pool* pool = first->home();
+			int target = pool->wakeTarget(first->homeWorker());
+			coroutineListType batch;
+			for(coroutine* co = first; co; ) {
+				coroutine* next = coroutineListType::next(co);
+				if (co->home() == pool && pool->wakeTarget(co->homeWorker()) == target) {
+					cos.remove(co);
+					batch.push_back(co);
+				}
+				co = next;
+			}
+			pool->addImmediatelyTasks(batch, target);
 		}
 	}
 	static coroutine* getRunningTask() {
 		return curSchedule.get()->running();
 	}
+	// the most workers the pool may run, worker indexes stay below it
+	int threadCount() const {
+		return m_threadCount;
+	}
+	int activeThreads() const {
+		return m_active.load(std::memory_order_relaxed);
+	}
+	// index of the calling worker in its pool, -1 off-pool
+	static int currentWorker() {
+		return int(curThreadId.get()) - 1;
+	}
+	void metrics(PoolMetrics& out) const {
+		out.workers.assign(m_threadCount, WorkerMetrics());
+		out.total = WorkerMetrics();
+		for(int i=0; i<m_threadCount; i++) {
+			out.workers[i].add(*m_stats[i]);
+			{
+				scoped_lock _(*m_lock[i]);
+				out.workers[i].queueDepth = m_tasks[i].size() + m_inline[i].size();
+			}
+			out.total.merge(out.workers[i]);
+		}
+		WorkerMetrics external;
+		external.add(*m_stats[m_threadCount]);
+		out.total.merge(external);
+	}
 private:
+	// a worker slot only takes tasks while RUNNING; EXITING while its
+	// thread hands the queue over, STOPPED once the slot can be restarted
+	enum slot_state_t {
+		STOPPED = 0,
+		RUNNING,
+		EXITING
+	};
+	struct WorkerSlot {
+		Pool* pool;
+		int idx;
+		KAFFINITY mask;
+	};
+	struct InlineTask : public ListHook {
+		coroutine_func_t func;
+		void* ud;
+		unsigned long long queuedAt;
+	};
+	typedef IntrusiveList<InlineTask> inlineListType;
+	// coroutine running a worker's inline tasks. idle is set while it
+	// waits for more, a switch out at any other time hands it to its task.
+	struct Dispatcher {
+		coroutine* co;
+		bool idle;
+		Dispatcher() : co(NULL), idle(true) {}
+	};
+	enum perf_mode_t {
+		PERF_OFF = 0,
+		PERF_ON,
+		PERF_TASKS
+	};
+	// hardware counters of one worker, read and summed by it alone
+	struct PerfWorker {
+		PerfCounters counters;
+		bool tried;
+		mutable sys::Mutex lock;
+		unsigned int available;
+		PerfCounters::Sample total;
+		std::map<coroutine_func_t, PerfCounters::Sample> tasks;
+		PerfWorker() : tried(false), available(0) {}
+		// opens or closes the counters to follow mode, true when counting
+		bool follow(int mode) {
+			if (mode == PERF_OFF) {
+				if (tried) {
+					counters.close();
+					tried = false;
+				}
+				return false;
+			}
+			if (!tried) {
+				tried = true;
+				counters.open();
+				scoped_lock _(lock);
+				available |= counters.available();
+			}
+			return counters.opened();
+		}
+		void record(coroutine_func_t func, const PerfCounters::Sample& before, bool perTask) {
+			PerfCounters::Sample after;
+			if (!counters.read(after)) {
+				return;
+			}
+			PerfCounters::Sample d = before.until(after);
+			scoped_lock _(lock);
+			total.add(d);
+			if (perTask) {
+				tasks[func].add(d);
+			}
+		}
+	};
 	std::vector<sys::Mutex*> m_lock;
 	std::vector<coroutineListType> m_tasks;
-	std::vector<sys::Semaphore*> m_sem;
+	std::vector<inlineListType> m_inline;
+	// owning worker only
+	std::vector<Dispatcher> m_dispatchers;
+	std::vector<Reactor*> m_reactors;
+	// one per worker plus a shared one for threads outside the pool
+	std::vector<WorkerStats*> m_stats;
+	std::vector<WorkerSlot> m_slots;
+	std::vector<std::atomic<int> > m_state;
+	// set while the worker may block in its reactor, see notifyParked()
+	std::vector<std::atomic<int> > m_parked;
+	std::atomic<bool> m_busyPoll;
+	std::vector<PerfWorker*> m_perf;
+	std::atomic<int> m_perfMode;
+	// finished coroutines, only touched by the owning worker
+	struct FreeList {
+		coroutineListType items;
+		inlineListType inlineTasks;
+		// fewest cached since the last trim, that many went unused
+		size_t lowWater;
+		unsigned long long lastTrim;
+		FreeList() : lowWater(0), lastTrim(0) {}
+	};
+	std::vector<FreeList> m_localFree;
+	// shared overflow, also feeds submitters outside the pool
 	coroutineListType m_freeRoutines;
 	sys::Mutex m_freeLock;
+	std::atomic<size_t> m_freeCap;
+	int m_numaNode;
+	NUMAExecutorGroup* m_group;
 	bool m_Exit;
 	int m_threadCount;
+	// guards m_threads and starting workers
+	sys::Mutex m_scaleLock;
 	std::vector<Thread*> m_threads;
-	std::atomic<int> m_index;
+	std::atomic<int> m_active;
 	std::atomic<unsigned int> m_curIdx;
 	thread_init_t m_threadInit;
 	void * m_ctx;
+	// elastic sizing, see setElastic()
+	std::atomic<int> m_minThreads;
+	unsigned int m_growDepth;
+	unsigned long long m_growTicks;
+	unsigned long long m_retireTicks;
+	int m_retireMs;
+	std::atomic<unsigned long long> m_pressureSince;
+	// tasks submitted and not finished yet, for drain() and admission
+	std::atomic<long> m_live;
+	std::atomic<long> m_admitLimit;
+	overload_policy_t m_overload;
+	// submitters waiting for room under OVERLOAD_WAIT
+	struct RoomWaiter : public ListHook {
+		Pool* pool;
+		// off-pool waiters block on sem instead
+		coroutine* co;
+		sys::Semaphore* sem;
+	};
+	IntrusiveList<RoomWaiter> m_roomWaiters;
+	sys::Mutex m_roomLock;
+	std::atomic<int> m_roomWaiting;
+	std::atomic<bool> m_draining;
+	sys::Semaphore m_drained;
+	wake_policy_t m_wakePolicy;
+
+	bool elastic() const {
+		return m_minThreads.load(std::memory_order_relaxed) < m_threadCount;
+	}
+	// m_scaleLock held
+	void start(int idx) {
+		m_state[idx].store(RUNNING);
+		m_active.fetch_add(1);
+		m_threads[idx] = new Thread(s_routine, &m_slots[idx], coroutine_schedule::STACK_SIZE, m_slots[idx].mask);
+		if (!m_threads[idx]->started()) {
+			// lockSlot() passes the slot's tasks on to the running ones
+			delete m_threads[idx];
+			m_threads[idx] = NULL;
+			m_active.fetch_sub(1);
+			m_state[idx].store(STOPPED);
+		}
+	}
+	void grow() {
+		scoped_lock _(m_scaleLock);
+		if (m_Exit) {
+			return;
+		}
+		for(int i=0; i<m_threadCount; i++) {
+			if (m_state[i].load() != STOPPED) {
+				continue;
+			}
+			// the old thread is past its last touch of the slot
+			if (m_threads[i]) {
+				m_threads[i]->join();
+				delete m_threads[i];
+				m_threads[i] = NULL;
+			}
+			start(i);
+			return;
+		}
+	}
+	// called on every submission that found a deep queue
+	void notePressure() {
+		unsigned long long now = Trace::timestamp();
+		unsigned long long since = m_pressureSince.load(std::memory_order_relaxed);
+		if (!since) {
+			m_pressureSince.compare_exchange_strong(since, now, std::memory_order_relaxed);
+		} else if (now - since >= m_growTicks && m_active.load() < m_threadCount
+			&& m_pressureSince.compare_exchange_strong(since, now, std::memory_order_relaxed)) {
+			grow();
+		}
+	}
+	// hands the worker's queue over to the running ones, false when the
+	// pool is already down to its minimum
+	bool retire(int idx) {
+		int active = m_active.load();
+		do {
+			if (active <= m_minThreads.load()) {
+				return false;
+			}
+		} while (!m_active.compare_exchange_weak(active, active - 1));
+		coroutineListType left;
+		{
+			scoped_lock _(*m_lock[idx]);
+			m_state[idx].store(EXITING);
+			left.swap(m_tasks[idx]);
+		}
+		inlineListType leftInline;
+		{
+			scoped_lock _(*m_lock[idx]);
+			leftInline.swap(m_inline[idx]);
+		}
+		while (!left.empty()) {
+			coroutine* co = left.front();
+			left.pop_front();
+			push(co, -1, false);
+		}
+		while (!leftInline.empty()) {
+			InlineTask* t = leftInline.front();
+			leftInline.pop_front();
+			unsigned int slot = lockSlot(m_curIdx.fetch_add(1));
+			m_inline[slot].push_back(t);
+			m_lock[slot]->unlock();
+			notifyParked(slot);
+		}
+		FreeList& fl = m_localFree[idx];
+		spill(idx, fl.items.size(), m_freeCap.load(std::memory_order_relaxed));
+		fl.lowWater = 0;
+		return true;
+	}
+	// counts a new task, refusing outside submissions while draining and
+	// applying the overload policy past the admission limit
+	bool admit() {
+		for(;;) {
+			long live = m_live.fetch_add(1) + 1;
+			if (m_draining.load() && curPool.get() != this) {
+				finished();
+				return false;
+			}
+			long limit = m_admitLimit.load(std::memory_order_relaxed);
+			if (!limit || live <= limit) {
+				return true;
+			}
+			if (m_overload == OVERLOAD_SHED && curPool.get() == this && live <= 2 * limit) {
+				return true;
+			}
+			finished();
+			if (m_overload != OVERLOAD_WAIT) {
+				bool owner;
+				WorkerStats& stats = callerStats(owner);
+				WorkerStats::bump(stats.tasksRejected, owner);
+				return false;
+			}
+			waitForRoom();
+		}
+	}
+	bool admitRelayed() {
+		assert(curPool.get() == this);
+		long live = m_live.fetch_add(1) + 1;
+		long limit = m_admitLimit.load(std::memory_order_relaxed);
+		if (!limit || live <= limit + 1) {
+			return true;
+		}
+		finished();
+		WorkerStats::bump(m_stats[currentWorker()]->tasksRejected, true);
+		return false;
+	}
+	void finished() {
+		if (m_live.fetch_sub(1) == 1 && m_draining.load()) {
+			m_drained.up();
+		}
+		if (m_roomWaiting.load() && hasRoom()) {
+			wakeRoomWaiter();
+		}
+	}
+	bool hasRoom() const {
+		long limit = m_admitLimit.load(std::memory_order_relaxed);
+		return !limit || m_live.load() < limit;
+	}
+	// returns once there may be room, admit() tries again
+	void waitForRoom() {
+		RoomWaiter w;
+		w.pool = this;
+		if (curPool.get()) {
+			w.co = getRunningTask();
+			w.sem = NULL;
+			w.co->park(s_parkRoomWaiter, &w);
+		} else {
+			sys::Semaphore sem;
+			w.co = NULL;
+			w.sem = &sem;
+			queueRoomWaiter(&w);
+			sem.down();
+		}
+	}
+	// runs once the waiter is off its stack, see coroutine::park
+	static void s_parkRoomWaiter(void* ctx) {
+		RoomWaiter* w = reinterpret_cast<RoomWaiter*>(ctx);
+		w->pool->queueRoomWaiter(w);
+	}
+	void queueRoomWaiter(RoomWaiter* w) {
+		{
+			scoped_lock _(m_roomLock);
+			m_roomWaiters.push_back(w);
+			m_roomWaiting.fetch_add(1);
+		}
+		// a task may have finished before the waiter was counted
+		if (hasRoom()) {
+			wakeRoomWaiter();
+		}
+	}
+	void wakeRoomWaiter() {
+		RoomWaiter* w;
+		{
+			scoped_lock _(m_roomLock);
+			w = m_roomWaiters.front();
+			if (!w) {
+				return;
+			}
+			m_roomWaiters.pop_front();
+			m_roomWaiting.fetch_sub(1);
+		}
+		if (w->co) {
+			wake(w->co);
+		} else {
+			w->sem->up();
+		}
+	}
+
+	static const int TRIM_INTERVAL_MS = 1000;
+	// inline tasks run back to back before the worker looks at its other queues
+	static const int INLINE_BATCH = 64;
+	// idle rounds between non-blocking reactor polls in busy-poll mode
+	static const unsigned int BUSY_POLL_SPINS = 64;
+	static const size_t INLINE_CACHE = 256;
+	static void freeAll(coroutineListType& list) {
+		while (!list.empty()) {
+			coroutine* co = list.front();
+			list.pop_front();
+			coroutine::destroy(co);
+		}
+	}
+	static void freeAll(inlineListType& list) {
+		while (!list.empty()) {
+			InlineTask* t = list.front();
+			list.pop_front();
+			delete t;
+		}
+	}
+	void pushInline(coroutine_func_t func, void * ud, int targetIdx) {
+		InlineTask* t = getInlineTask();
+		t->func = func;
+		t->ud = ud;
+		t->queuedAt = Trace::timestamp();
+		unsigned int slot = lockSlot(targetIdx != -1 ? targetIdx : m_curIdx.fetch_add(1));
+		NUMA_TRACE_EVENT(SUBMIT, t);
+		m_inline[slot].push_back(t);
+		size_t depth = m_inline[slot].size() + m_tasks[slot].size();
+		m_lock[slot]->unlock();
+		notifyParked(slot);
+		if (depth >= m_growDepth && elastic()) {
+			notePressure();
+		}
+	}
+	InlineTask* getInlineTask() {
+		int worker = currentWorker();
+		if (worker >= 0 && curPool.get() == this) {
+			inlineListType& cache = m_localFree[worker].inlineTasks;
+			InlineTask* t = cache.back();
+			if (t) {
+				cache.pop_back();
+				return t;
+			}
+		}
+		return new InlineTask;
+	}
+	void freeInlineTask(int idx, InlineTask* t) {
+		inlineListType& cache = m_localFree[idx].inlineTasks;
+		if (cache.size() < INLINE_CACHE) {
+			cache.push_back(t);
+		} else {
+			delete t;
+		}
+	}
+	// own queue first, then the other workers'
+	InlineTask* takeInline(int idx) {
+		for(int n=0; n<m_threadCount; n++) {
+			int i = (idx + n) % m_threadCount;
+			scoped_lock _(*m_lock[i]);
+			InlineTask* t = m_inline[i].front();
+			if (t) {
+				m_inline[i].pop_front();
+				if (n) {
+					NUMA_TRACE_EVENT(STEAL, i);
+					WorkerStats::bump(m_stats[idx]->steals, true);
+				}
+				return t;
+			}
+		}
+		return NULL;
+	}
+	static void s_dispatch(void* p) {
+		reinterpret_cast<Pool*>(p)->dispatch();
+	}
+	bool isDispatcher(coroutine* co) const {
+		return co->func() == s_dispatch;
+	}
+	// Body of a dispatcher coroutine. Once a task has blocked or yielded in
+	// it, it is no longer its worker's dispatcher and ends with that task,
+	// possibly on another worker.
+	void dispatch() {
+		coroutine* self = getRunningTask();
+		int batch = 0;
+		for(;;) {
+			int idx = currentWorker();
+			Dispatcher& d = m_dispatchers[idx];
+			if (d.co != self) {
+				return;
+			}
+			InlineTask* t = batch < INLINE_BATCH ? takeInline(idx) : NULL;
+			if (!t) {
+				batch = 0;
+				d.idle = true;
+				self->yield();
+				continue;
+			}
+			batch++;
+			coroutine_func_t func = t->func;
+			void* ud = t->ud;
+			unsigned long long start = Trace::timestamp();
+			m_stats[idx]->queueWait.record(start - t->queuedAt);
+			freeInlineTask(idx, t);
+			func(ud);
+			// one that blocked shows up as the slices of this coroutine
+			if (m_dispatchers[currentWorker()].co == self) {
+				NUMA_TRACE_SPAN(INLINE, t, start);
+			}
+			WorkerStats& stats = *m_stats[currentWorker()];
+			stats.runTime.record(Trace::timestamp() - start);
+			WorkerStats::bump(stats.tasksRun, true);
+			finished();
+		}
+	}
+	// lets an idle dispatcher run to its end
+	void stopDispatcher(coroutine_schedule& cs, int idx) {
+		Dispatcher& d = m_dispatchers[idx];
+		coroutine* co = d.co;
+		if (co) {
+			d.co = NULL;
+			cs.resume(co);
+			recycle(idx, co);
+		}
+	}
+	// caller holds m_lock[i]. Inline work is run by handing out the
+	// dispatcher, preferInline alternates it with queued coroutines.
+	coroutine* take(int i, coroutine* dispatcher, bool preferInline) {
+		bool hasInline = !m_inline[i].empty();
+		if (!m_tasks[i].empty() && !(hasInline && preferInline)) {
+			coroutine* co = m_tasks[i].front();
+			m_tasks[i].pop_front();
+			return co;
+		}
+		return hasInline ? dispatcher : NULL;
+	}
+	// moves the count oldest entries of worker idx's cache to the shared
+	// list, frees what does not fit under cap
+	void spill(int idx, size_t count, size_t cap) {
+		FreeList& fl = m_localFree[idx];
+		{
+			scoped_lock _(m_freeLock);
+			while (count && m_freeRoutines.size() < cap) {
+				coroutine* co = fl.items.front();
+				fl.items.pop_front();
+				m_freeRoutines.push_back(co);
+				count--;
+			}
+		}
+		for(; count; count--) {
+			coroutine* co = fl.items.front();
+			fl.items.pop_front();
+			coroutine::destroy(co);
+			WorkerStats::bump(m_stats[idx]->coroutinesFreed, true);
+		}
+		if (fl.lowWater > fl.items.size()) {
+			fl.lowWater = fl.items.size();
+		}
+	}
+	void recycle(int idx, coroutine* co) {
+		FreeList& fl = m_localFree[idx];
+		fl.items.push_back(co);
+		size_t cap = m_freeCap.load(std::memory_order_relaxed);
+		if (fl.items.size() > cap) {
+			spill(idx, fl.items.size() - cap / 2, cap);
+		}
+	}
+	void refill(FreeList& fl) {
+		size_t batch = m_freeCap.load(std::memory_order_relaxed) / 2 + 1;
+		scoped_lock _(m_freeLock);
+		while (batch-- && !m_freeRoutines.empty()) {
+			coroutine* co = m_freeRoutines.back();
+			m_freeRoutines.pop_back();
+			fl.items.push_back(co);
+		}
+	}
+	// frees what sat unused in the cache for a whole interval
+	void trim(int idx) {
+		FreeList& fl = m_localFree[idx];
+		size_t count = fl.lowWater;
+		for(; count; count--) {
+			coroutine* co = fl.items.front();
+			fl.items.pop_front();
+			coroutine::destroy(co);
+			WorkerStats::bump(m_stats[idx]->coroutinesFreed, true);
+		}
+		fl.lowWater = fl.items.size();
+	}
 
-	void routine() {
-		auto idx = m_index.fetch_add(1) + 1;
-		curThreadId.set(idx);
+	void routine(int idx) {
+		curThreadId.set(idx + 1);
 		if (m_threadInit) {
-			m_threadInit(m_ctx, idx);
+			m_threadInit(m_ctx, idx + 1);
 		}
 		coroutine_schedule cs;
 		curSchedule.set(&cs);
-		idx--;
 		curPool.set(this);
+		Reactor& reactor = *m_reactors[idx];
+		curReactor.set(&reactor);
+		// coroutines whose I/O or timer completed, only ever resumed here
+		coroutineListType ioReady;
+		unsigned int dispatched = 0;
+		unsigned long long idleSince = 0;
+		unsigned int idleSpins = 0;
+		WorkerStats& stats = *m_stats[idx];
+		FreeList& freeList = m_localFree[idx];
+		unsigned long long trimTicks = (unsigned long long)(TRIM_INTERVAL_MS * 1000.0 * Trace::ticksPerUs());
+		freeList.lastTrim = Trace::timestamp();
+		Dispatcher& disp = m_dispatchers[idx];
+		// counters are per thread, a restarted slot opens its own
+		PerfWorker& perf = *m_perf[idx];
+		perf.follow(PERF_OFF);
 		while(!m_Exit) {
+			if (!disp.co) {
+				disp.co = getCoroutine(s_dispatch, this);
+			}
+			bool preferInline = (dispatched & 1) != 0;
 			coroutine* task = NULL;
+			if (!ioReady.empty()) {
+				task = ioReady.front();
+				ioReady.pop_front();
+			}
 			// ӵǰҳ
-			{
+			if (!task) {
 				scoped_lock _(*m_lock[idx]);
-				if (!m_tasks[idx].empty()) {
-					task = m_tasks[idx].front();
-					m_tasks[idx].pop_front();
-				}
+				task = take(idx, disp.co, preferInline);
 			}
 			for(int i=0; i < m_threadCount && task == NULL; i++) {
 				scoped_lock _(*m_lock[i]);
-				if (!m_tasks[i].empty()) {
-					task = m_tasks[i].front();
-					m_tasks[i].pop_front();
-					break;
+				task = take(i, disp.co, preferInline);
+				if (task && task != disp.co && i != idx) {
+					NUMA_TRACE_EVENT(STEAL, i);
+					WorkerStats::bump(stats.steals, true);
 				}
 			}
+			if (!task && m_busyPoll.load(std::memory_order_relaxed)) {
+				if (reactor.pending() && ++idleSpins % BUSY_POLL_SPINS == 0) {
+					pollReactor(reactor, 0, ioReady);
+				} else {
+					sys::cpuRelax();
+				}
+				continue;
+			}
 			if (!task) {
-				m_sem[idx]->down();
+				WorkerStats::bump(stats.failedSteals, true);
+				m_pressureSince.store(0, std::memory_order_relaxed);
+				int timeoutMs = -1;
+				unsigned long long now = Trace::timestamp();
+				if (elastic()) {
+					if (!idleSince) {
+						idleSince = now;
+					} else if (now - idleSince >= m_retireTicks && !reactor.pending() && retire(idx)) {
+						break;
+					}
+					timeoutMs = m_retireMs;
+				}
+				if (now - freeList.lastTrim >= trimTicks) {
+					trim(idx);
+					freeList.lastTrim = now;
+				}
+				if (!freeList.items.empty() && (timeoutMs < 0 || timeoutMs > TRIM_INTERVAL_MS)) {
+					timeoutMs = TRIM_INTERVAL_MS;
+				}
+				m_parked[idx].store(1);
+				// a submission that missed the flag is queued by now
+				if (queued(idx) || m_busyPoll.load()) {
+					m_parked[idx].store(0);
+					continue;
+				}
+				WorkerStats::bump(stats.parks, true);
+				NUMA_TRACE_EVENT(PARK, 0);
+				pollReactor(reactor, timeoutMs, ioReady);
+				NUMA_TRACE_EVENT(UNPARK, 0);
+				WorkerStats::bump(stats.unparks, true);
+				m_parked[idx].store(0);
 			} else {
-				cs.resume(task);
-				switch(task->status()) {
+				idleSince = 0;
+				if ((++dispatched & 63) == 0 && reactor.pending()) {
+					pollReactor(reactor, 0, ioReady);
+				}
+				NUMA_TRACE_EVENT(RESUME, task);
+				unsigned long long start = Trace::timestamp();
+				bool dispatching = task == disp.co;
+				if (dispatching) {
+					disp.idle = false;
+				} else {
+					stats.queueWait.record(start - task->queuedAt());
+				}
+				WorkerStats::bump(stats.resumes, true);
+				task->setHome(this, idx);
+				int perfMode = m_perfMode.load(std::memory_order_relaxed);
+				PerfCounters::Sample perfBefore;
+				bool counting = perf.follow(perfMode) && perf.counters.read(perfBefore);
+				coroutine_func_t func = task->func();
+				coroutine::status_t status = cs.resume(task);
+				if (counting) {
+					perf.record(func, perfBefore, perfMode == PERF_TASKS);
+				}
+				// a parked task may be running elsewhere by now, only touch it if it finished or yielded
+				unsigned long long slice = Trace::timestamp() - start;
+				if (dispatching) {
+					if (status == coroutine::SUSPEND && disp.idle) {
+						NUMA_TRACE_EVENT(YIELD, task);
+						continue;
+					}
+					// an inline task blocked or yielded, the coroutine is its own now
+					disp.co = NULL;
+				}
+				switch(status) {
 				case coroutine::DEAD:
-					delete task;
+					NUMA_TRACE_EVENT(END, task);
+					if (!isDispatcher(task)) {
+						stats.runTime.record(task->addRunTicks(slice));
+						WorkerStats::bump(stats.tasksRun, true);
+						finished();
+					}
+					coroutine::destroy(task);
 					break;
 				case coroutine::WAITING:
+					NUMA_TRACE_EVENT(BLOCK, task);
 					break;
 				case coroutine::READY:
-					{
-						scoped_lock _(m_freeLock);
-						m_freeRoutines.push_back(task);
+					NUMA_TRACE_EVENT(END, task);
+					// a former dispatcher, its inline tasks counted themselves
+					if (!isDispatcher(task)) {
+						stats.runTime.record(task->addRunTicks(slice));
+						WorkerStats::bump(stats.tasksRun, true);
+						finished();
 					}
+					recycle(idx, task);
 					break;
 				default:
+					NUMA_TRACE_EVENT(YIELD, task);
+					task->addRunTicks(slice);
+					task->setQueuedAt(Trace::timestamp());
 					{
 						scoped_lock _(*m_lock[idx]);
 						m_tasks[idx].push_back(task);
@@ -202,22 +1083,138 @@ private:
 				}
 			}
 		}
+		stopDispatcher(cs, idx);
+		perf.follow(PERF_OFF);
+		m_state[idx].store(STOPPED);
 	}
 	static void s_routine(void *p) {
-		reinterpret_cast<Pool*>(p)->routine();
+		WorkerSlot* slot = reinterpret_cast<WorkerSlot*>(p);
+		slot->pool->routine(slot->idx);
+		Trace::threadExit();
+	}
+	void pollReactor(Reactor& reactor, int timeoutMs, coroutineListType& ready) {
+		coroutine* last = ready.back();
+		reactor.poll(timeoutMs, ready);
+		coroutine* co = last ? coroutineListType::next(last) : ready.front();
+		if (co) {
+			unsigned long long now = Trace::timestamp();
+			for(; co; co = coroutineListType::next(co)) {
+				co->setQueuedAt(now);
+			}
+		}
+	}
+	// stats slot of the calling thread, the shared one when it is not ours
+	WorkerStats& callerStats(bool& owner) const {
+		int worker = currentWorker();
+		owner = worker >= 0 && curPool.get() == this;
+		return *m_stats[owner ? worker : m_threadCount];
+	}
+	int wakeTarget(int home) const {
+		if (m_wakePolicy == WAKE_WAKER && curPool.get() == this) {
+			return currentWorker();
+		}
+		return home;
+	}
+	bool enqueue(coroutine* co, int targetIdx, bool front) {
+		co->setQueuedAt(Trace::timestamp());
+		return push(co, targetIdx, front);
+	}
+	bool push(coroutine* co, int targetIdx, bool front) {
+		unsigned int slot = lockSlot(targetIdx != -1 ? targetIdx : m_curIdx.fetch_add(1));
+		NUMA_TRACE_EVENT(SUBMIT, co);
+		if (front)
+			m_tasks[slot].push_front(co);
+		else
+			m_tasks[slot].push_back(co);
+		size_t depth = m_tasks[slot].size() + m_inline[slot].size();
+		m_lock[slot]->unlock();
+		notifyParked(slot);
+		if (depth >= m_growDepth && elastic()) {
+			notePressure();
+		}
+		return true;
+	}
+	// Called after queueing on slot. A worker only needs waking once it is
+	// about to block, and it checks its queue again after saying so, so
+	// running or spinning workers cost submitters no syscall.
+	void notifyParked(unsigned int slot) {
+		if (m_parked[slot].load()) {
+			m_reactors[slot]->notify();
+		}
+	}
+	bool queued(int idx) {
+		scoped_lock _(*m_lock[idx]);
+		return !m_tasks[idx].empty() || !m_inline[idx].empty();
+	}
+	// Locks and returns the first running slot from idx on. A retired
+	// worker's slot passes its tasks on this way; with no worker running at
+	// all they stay on idx.
+	unsigned int lockSlot(unsigned int idx) {
+		for(int i=0; ; i++) {
+			unsigned int slot = (idx + i) % m_threadCount;
+			if (i < m_threadCount && m_state[slot].load(std::memory_order_relaxed) != RUNNING) {
+				continue;
+			}
+			m_lock[slot]->lock();
+			if (i < m_threadCount && m_state[slot].load(std::memory_order_relaxed) != RUNNING) {
+				m_lock[slot]->unlock();
+				continue;
+			}
+			return slot;
+		}
+	}
+	// a coroutine that runs f, see addTask(F)
+	template<class F>
+	coroutine* closureTask(F&& f) {
+		typedef typename std::decay<F>::type Fn;
+		typedef detail::Closure<Fn> closure;
+		if (closure::INPLACE) {
+			coroutine* co = getCoroutine(closure::s_run, NULL);
+			new (co->closure()) Fn(std::forward<F>(f));
+			return co;
+		}
+		void* p = detail::allocClosure(m_group, sizeof(Fn));
+		if (!p) {
+			throw std::bad_alloc();
+		}
+		try {
+			new (p) Fn(std::forward<F>(f));
+		} catch (...) {
+			detail::freeClosure(p);
+			throw;
+		}
+		return getCoroutine(closure::s_run, p);
 	}
 	coroutine* getCoroutine(coroutine_func_t func, void * ud) {
 		coroutine* co = NULL;
-		{
+		bool owner;
+		WorkerStats& stats = callerStats(owner);
+		if (owner) {
+			FreeList& fl = m_localFree[currentWorker()];
+			if (fl.items.empty()) {
+				refill(fl);
+			}
+			if (!fl.items.empty()) {
+				co = fl.items.back();
+				fl.items.pop_back();
+				if (fl.lowWater > fl.items.size()) {
+					fl.lowWater = fl.items.size();
+				}
+			}
+		} else {
 			scoped_lock _(m_freeLock);
 			if (!m_freeRoutines.empty()) {
-				co = m_freeRoutines.front();
-				m_freeRoutines.pop_front();
-				co->reset(func, ud);
-				return co;
+				co = m_freeRoutines.back();
+				m_freeRoutines.pop_back();
 			}
 		}
-		return new coroutine(func, ud);
+		if (co) {
+			co->reset(func, ud);
+			WorkerStats::bump(stats.coroutinesRecycled, owner);
+			return co;
+		}
+		WorkerStats::bump(stats.coroutinesCreated, owner);
+		return coroutine::create(func, ud, m_numaNode);
 	}
 };
 
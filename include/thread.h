@@ -40,15 +40,28 @@ namespace Task {
 			if (stackSize) {
 				pthread_attr_setstacksize(&attr, stackSize);
 			}
-			pthread_create(&m_thread, &attr, s_routine, this);
+			// fails for an affinity naming CPUs the machine lacks
+			m_started = pthread_create(&m_thread, &attr, s_routine, this) == 0;
+#endif
+		}
+		// false when the thread could not be created
+		bool started() const {
+#ifdef _WIN32
+			return m_handle != NULL;
+#else
+			return m_started;
 #endif
 		}
 		void join() const {
 #ifdef _WIN32
-			WaitForSingleObject(m_handle, INFINITE);
+			if (m_handle) {
+				WaitForSingleObject(m_handle, INFINITE);
+			}
 #else
 			void * retval;
-			pthread_join(m_thread, &retval);
+			if (m_started) {
+				pthread_join(m_thread, &retval);
+			}
 #endif
 		}
 	private:
@@ -57,6 +70,7 @@ namespace Task {
 		static unsigned __stdcall s_routine(void* _self) {
 #else
 		pthread_t m_thread;
+		bool m_started;
 		static void * s_routine(void* _self) {
 #endif
 			Thread* self = reinterpret_cast<Thread*>(_self);
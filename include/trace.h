@@ -0,0 +1,109 @@
+#ifndef _NUMA_TRACE_H_
+#define _NUMA_TRACE_H_
+#include <atomic>
+#include <ostream>
+#include <stdint.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// Scheduler event tracing. Build with -DNUMA_TRACE to compile the hooks in,
+// then switch recording on and off at runtime with Trace::enable(). Without
+// NUMA_TRACE every hook expands to nothing.
+//
+// Each thread appends to its own ring buffer (single writer, no locks) and
+// old events are overwritten once it is full. Buffers of exited threads are
+// dumped once more, then handed to new threads. Timestamps are raw TSC reads,
+// converted when dumping. dumpChrome() writes Chrome trace JSON, which
+// chrome://tracing and the Perfetto UI both load.
+
+#ifndef NUMA_TRACE_BUFFER_EVENTS
+#define NUMA_TRACE_BUFFER_EVENTS 65536
+#endif
+
+namespace Task {
+	class Trace {
+	public:
+		enum event_t {
+			SUBMIT = 0,		// arg: coroutine queued
+			START,			// arg: coroutine entering its task function
+			RESUME,			// arg: coroutine switched in
+			YIELD,			// arg: coroutine switched out, still runnable
+			BLOCK,			// arg: coroutine switched out waiting
+			END,			// arg: coroutine finished its task
+			WAIT_SEMAPHORE,	// arg: Task::Semaphore about to block on
+			WAIT_EVENT,		// arg: Task::Event
+			WAIT_BARRIER,	// arg: Task::Barrier
+			WAIT_MUTEX,		// arg: Task::Mutex or SharedMutex
+			WAIT_CONDITION,	// arg: Task::ConditionVariable
+			WAIT_CHANNEL,	// arg: first Task::Channel waited on
+			WAIT_FUTURE,	// arg: future state
+			WAIT_IO,		// arg: fd, -1 for timers
+			WAIT_BLOCKING,	// arg: function handed to the blocking pool
+			STEAL,			// arg: worker index stolen from
+			PARK,			// worker going to sleep
+			UNPARK,			// worker woke up
+			INLINE,			// arg: inline task that ran to its end, with its duration
+			EVENT_COUNT
+		};
+		static void enable(bool on) {
+			if (on) {
+				calibrate();
+			}
+			s_enabled.store(on, std::memory_order_relaxed);
+		}
+		static bool enabled() {
+			return s_enabled.load(std::memory_order_relaxed);
+		}
+		static void record(event_t type, uint64_t arg);
+		// an event that began at start and lasts until now
+		static void recordSpan(event_t type, uint64_t arg, uint64_t start);
+		// forget everything recorded so far
+		static void reset();
+		// the calling thread records no more; pool threads call this on
+		// their way out
+		static void threadExit();
+		// best taken while the pools are quiet, events written during the
+		// dump may show up torn
+		static void dumpChrome(std::ostream& os);
+		// TSC rate, measured once on first use
+		static double ticksPerUs();
+
+		static inline uint64_t timestamp() {
+#if defined(_MSC_VER)
+			return __rdtsc();
+#elif defined(__x86_64__) || defined(__i386__)
+			uint32_t lo, hi;
+			__asm__ __volatile__("rdtsc" : "=a"(lo), "=d"(hi));
+			return (uint64_t(hi) << 32) | lo;
+#else
+			return monotonicNs();
+#endif
+		}
+	private:
+		static std::atomic<bool> s_enabled;
+		static void calibrate();
+		static uint64_t monotonicNs();
+		static void append(event_t type, uint64_t arg, uint64_t tsc, uint64_t duration);
+	};
+}
+
+#ifdef NUMA_TRACE
+#define NUMA_TRACE_EVENT(type, arg) \
+	do { \
+		if (Task::Trace::enabled()) { \
+			Task::Trace::record(Task::Trace::type, (uint64_t)(uintptr_t)(arg)); \
+		} \
+	} while (0)
+#define NUMA_TRACE_SPAN(type, arg, start) \
+	do { \
+		if (Task::Trace::enabled()) { \
+			Task::Trace::recordSpan(Task::Trace::type, (uint64_t)(uintptr_t)(arg), (start)); \
+		} \
+	} while (0)
+#else
+#define NUMA_TRACE_EVENT(type, arg) ((void)0)
+#define NUMA_TRACE_SPAN(type, arg, start) ((void)0)
+#endif
+
+#endif
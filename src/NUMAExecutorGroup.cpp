@@ -4,6 +4,7 @@
 NUMAExecutorGroup::NUMAExecutorGroup(int NUMANode, KAFFINITY affinity)
 	: m_NUMANode(NUMANode)
 	, m_affinity(affinity)
+	, m_thread(NULL)
 {
 	int cnt = 0;
 	KAFFINITY _1 = 1;
@@ -14,12 +15,17 @@ NUMAExecutorGroup::NUMAExecutorGroup(int NUMANode, KAFFINITY affinity)
 	}
 	m_thrCount = cnt;
 	m_memPool = new memPoolType(NUMANode);
-	m_taskPool = new Task::Pool(cnt, affinity, s_thread_init, this);
+	m_taskPool = new Task::Pool(cnt, affinity, s_thread_init, this, NUMANode);
+	m_taskPool->setGroup(this);
+	m_blockingPool = new Task::BlockingPool(Task::BlockingPool::DEFAULT_THREADS, affinity, s_thread_init, this);
 }
 
 NUMAExecutorGroup::~NUMAExecutorGroup(void)
 {
 	Stop();
+	// blocking calls still running hand their coroutine back to the pool
+	m_taskPool->join();
+	delete m_blockingPool;
 	delete m_taskPool;
 	delete m_memPool;
 }
@@ -29,5 +35,48 @@ void NUMAExecutorGroup::s_thread_init(void *ctx, int) {
 	curExecutorGroup.set(self);
 }
 
+// 16 bytes keeps the payload aligned like the pools themselves
+union localHeader {
+	memPoolType* pool;
+	char pad[16];
+};
 
-ThreadLocal<NUMAExecutorGroup*> curExecutorGroup;
+void* NUMAExecutorGroup::localAlloc(size_t size) {
+	NUMAExecutorGroup* eg = curExecutorGroup.get();
+	return allocFrom(eg ? eg->memPool() : NULL, size);
+}
+
+void* NUMAExecutorGroup::alloc(size_t size) {
+	return allocFrom(m_memPool, size);
+}
+
+void* NUMAExecutorGroup::allocFrom(memPoolType* pool, size_t size) {
+	localHeader* h = NULL;
+	if (pool) {
+		h = static_cast<localHeader*>(pool->alloc(sizeof(localHeader) + size));
+	}
+	if (!h) {
+		pool = NULL;
+		h = static_cast<localHeader*>(::malloc(sizeof(localHeader) + size));
+		if (!h) {
+			return NULL;
+		}
+	}
+	h->pool = pool;
+	return h + 1;
+}
+
+void NUMAExecutorGroup::localFree(void* p) {
+	if (!p) {
+		return;
+	}
+	localHeader* h = static_cast<localHeader*>(p) - 1;
+	if (h->pool) {
+		h->pool->free(h);
+	} else {
+		::free(h);
+	}
+}
+
+
+Task::ContextLocal<NUMAExecutorGroup*, &Task::WorkerContext::group> curExecutorGroup;
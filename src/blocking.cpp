@@ -0,0 +1,111 @@
+#include "blocking.h"
+#include "NUMAExecutorGroup.h"
+
+namespace Task {
+
+BlockingPool::BlockingPool(int maxThreads, KAFFINITY affinity, Pool::thread_init_t init_func, void* ctx)
+	: m_busy(0)
+	, m_Exit(false)
+	, m_maxThreads(maxThreads)
+	, m_affinity(affinity)
+	, m_threadInit(init_func)
+	, m_ctx(ctx)
+{
+	assert(maxThreads > 0);
+}
+
+BlockingPool::~BlockingPool() {
+	std::vector<Thread*> threads;
+	{
+		scoped_lock _(m_lock);
+		m_Exit = true;
+		threads.swap(m_threads);
+	}
+	// one extra wakeup per thread, each exits once the queue is empty
+	m_ready.up(int(threads.size()));
+	for (size_t i = 0; i < threads.size(); i++) {
+		threads[i]->join();
+		delete threads[i];
+	}
+}
+
+void BlockingPool::submit(detail::BlockingJob* job) {
+	{
+		scoped_lock _(m_lock);
+		m_jobs.push_back(job);
+		if (size_t(m_busy) + m_jobs.size() > m_threads.size() && int(m_threads.size()) < m_maxThreads) {
+			m_threads.push_back(new Thread(s_routine, this, 0, m_affinity));
+		}
+	}
+	m_ready.up();
+}
+
+int BlockingPool::threadCount() const {
+	scoped_lock _(m_lock);
+	return int(m_threads.size());
+}
+
+BlockingPool& BlockingPool::global() {
+	static BlockingPool pool;
+	return pool;
+}
+
+void BlockingPool::routine() {
+	if (m_threadInit) {
+		m_threadInit(m_ctx, 0);
+	}
+	for (;;) {
+		m_ready.down();
+		detail::BlockingJob* job;
+		{
+			scoped_lock _(m_lock);
+			if (m_jobs.empty()) {
+				assert(m_Exit);
+				return;
+			}
+			job = m_jobs.front();
+			m_jobs.pop_front();
+			m_busy++;
+		}
+		// the job lives on the waiting coroutine's stack, which may be gone
+		// as soon as the coroutine is queued again
+		coroutine* co = job->co;
+		job->func(job->ud);
+		Pool::wake(co);
+		{
+			scoped_lock _(m_lock);
+			m_busy--;
+		}
+	}
+}
+
+void BlockingPool::s_routine(void* p) {
+	reinterpret_cast<BlockingPool*>(p)->routine();
+	Trace::threadExit();
+}
+
+namespace {
+	// runs once the caller is off its stack, see coroutine::park
+	void s_submitJob(void* ctx) {
+		detail::BlockingJob* job = reinterpret_cast<detail::BlockingJob*>(ctx);
+		NUMAExecutorGroup* eg = curExecutorGroup.get();
+		BlockingPool& bp = eg ? eg->blockingPool() : BlockingPool::global();
+		bp.submit(job);
+	}
+}
+
+void run_blocking(coroutine_func_t func, void* ud) {
+	Pool* pool = curPool.get();
+	if (!pool) {
+		func(ud);
+		return;
+	}
+	NUMA_TRACE_EVENT(WAIT_BLOCKING, func);
+	detail::BlockingJob job;
+	job.func = func;
+	job.ud = ud;
+	job.co = Pool::getRunningTask();
+	job.co->park(s_submitJob, &job);
+}
+
+}
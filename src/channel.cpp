@@ -0,0 +1,162 @@
+#include "channel.h"
+#include <vector>
+
+namespace Task {
+
+// One blocked send, recv or select. Wakers may fire it while it is still
+// being queued on its channels; the queuing side then does the wakeup, so
+// nobody resumes the waiter before it is off every wait list's hands.
+struct ChannelBase::Waiter {
+	enum { ARMING = 0, WAITING = 1, FIRED = 2 };
+	std::atomic<int> state;
+	coroutine* co;
+	// off-pool waiters block here instead
+	sys::Semaphore* sem;
+	ChannelBase* const* channels;
+	int count;
+	bool write;
+	waitItem* items;
+	void resume() {
+		if (co) {
+			Pool::wake(co);
+		} else {
+			sem->up();
+		}
+	}
+};
+
+ChannelBase::ChannelBase()
+	: m_closed(false)
+{}
+
+void ChannelBase::close() {
+	m_closed.store(true, std::memory_order_release);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	wake(m_readers, size_t(-1));
+	wake(m_writers, size_t(-1));
+}
+
+void ChannelBase::waitReadable() {
+	ChannelBase* self = this;
+	wait(&self, 1, false);
+}
+
+void ChannelBase::waitWritable() {
+	ChannelBase* self = this;
+	wait(&self, 1, true);
+}
+
+void ChannelBase::wake(WaitList& list, size_t count) {
+	coroutineListType ready;
+	{
+		lock_guard<sys::Mutex> _(m_lock);
+		while (count && !list.items.empty()) {
+			waitItem* item = list.items.front();
+			list.items.pop_front();
+			item->queued = false;
+			list.waiting.fetch_sub(1, std::memory_order_relaxed);
+			Waiter* w = item->waiter;
+			int s = w->state.load(std::memory_order_acquire);
+			// a waiter still arming is woken by whoever arms it
+			while (s != Waiter::FIRED && !w->state.compare_exchange_weak(s, Waiter::FIRED, std::memory_order_acq_rel)) {}
+			if (s == Waiter::FIRED) {
+				continue;
+			}
+			// a select may go on to take from another channel, so it does
+			// not use up the wakeup meant for a receiver of this one
+			if (w->count == 1) {
+				count--;
+			}
+			if (s == Waiter::WAITING) {
+				if (w->co) {
+					ready.push_back(w->co);
+				} else {
+					w->sem->up();
+				}
+			}
+		}
+	}
+	if (!ready.empty()) {
+		Pool::wakeAll(ready);
+	}
+}
+
+void ChannelBase::enqueue(Waiter* w) {
+	for (int i = 0; i < w->count; i++) {
+		ChannelBase* ch = w->channels[i];
+		WaitList& list = w->write ? ch->m_writers : ch->m_readers;
+		waitItem& item = w->items[i];
+		item.waiter = w;
+		item.queued = true;
+		lock_guard<sys::Mutex> _(ch->m_lock);
+		list.items.push_back(&item);
+		list.waiting.fetch_add(1, std::memory_order_relaxed);
+	}
+	// pairs with the fence in notifyReaders/notifyWriters
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	bool ready = false;
+	for (int i = 0; i < w->count && !ready; i++) {
+		ready = w->write ? w->channels[i]->writable() : w->channels[i]->readable();
+	}
+	int s = Waiter::ARMING;
+	if (ready || !w->state.compare_exchange_strong(s, Waiter::WAITING, std::memory_order_acq_rel)) {
+		// fired while arming, or no need to wait at all
+		w->state.store(Waiter::FIRED, std::memory_order_release);
+		w->resume();
+	}
+}
+
+void ChannelBase::dequeue(Waiter* w) {
+	for (int i = 0; i < w->count; i++) {
+		ChannelBase* ch = w->channels[i];
+		WaitList& list = w->write ? ch->m_writers : ch->m_readers;
+		waitItem& item = w->items[i];
+		lock_guard<sys::Mutex> _(ch->m_lock);
+		if (item.queued) {
+			list.items.remove(&item);
+			list.waiting.fetch_sub(1, std::memory_order_relaxed);
+		}
+	}
+}
+
+// runs once the waiter is off its stack, see coroutine::park
+void ChannelBase::s_parkWaiter(void* ctx) {
+	enqueue(reinterpret_cast<Waiter*>(ctx));
+}
+
+void ChannelBase::wait(ChannelBase* const* channels, int count, bool write) {
+	waitItem one;
+	std::vector<waitItem> many(count > 1 ? count : 0);
+	Waiter w;
+	w.state.store(Waiter::ARMING, std::memory_order_relaxed);
+	w.channels = channels;
+	w.count = count;
+	w.write = write;
+	w.items = count > 1 ? &many[0] : &one;
+	NUMA_TRACE_EVENT(WAIT_CHANNEL, channels[0]);
+	if (curPool.get()) {
+		w.co = Pool::getRunningTask();
+		w.sem = NULL;
+		w.co->park(s_parkWaiter, &w);
+	} else {
+		sys::Semaphore sem;
+		w.co = NULL;
+		w.sem = &sem;
+		enqueue(&w);
+		sem.down();
+	}
+	dequeue(&w);
+}
+
+int select(ChannelBase* const* channels, int count) {
+	for (;;) {
+		for (int i = 0; i < count; i++) {
+			if (channels[i]->readable()) {
+				return i;
+			}
+		}
+		ChannelBase::wait(channels, count, false);
+	}
+}
+
+}
@@ -0,0 +1,119 @@
+#include "cohortlock.h"
+#include "localstorage.h"
+#ifndef _WIN32
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
+
+namespace Task {
+namespace sys {
+
+namespace {
+	// node + 1, 0 until looked up
+	ThreadLocal<size_t> s_curNode;
+
+	int nodeCount() {
+#ifdef _WIN32
+		ULONG highest = 0;
+		return ::GetNumaHighestNodeNumber(&highest) ? int(highest) + 1 : 1;
+#else
+		return numa_available() < 0 ? 1 : numa_max_node() + 1;
+#endif
+	}
+}
+
+void SpinMutex::lock() {
+	if (tryLock()) {
+		return;
+	}
+	m_waiters.fetch_add(1, std::memory_order_relaxed);
+	for (int i = 0; i < SPIN_COUNT; i++) {
+		cpuRelax();
+		if (m_state.load(std::memory_order_relaxed) == UNLOCKED && tryLock()) {
+			m_waiters.fetch_sub(1, std::memory_order_relaxed);
+			return;
+		}
+	}
+	// from here on the lock is taken as SLEEPERS, so unlock() wakes the rest
+	while (m_state.exchange(SLEEPERS, std::memory_order_acquire) != UNLOCKED) {
+#ifdef _WIN32
+		::SwitchToThread();
+#else
+		syscall(SYS_futex, reinterpret_cast<int*>(&m_state), FUTEX_WAIT_PRIVATE, SLEEPERS, NULL, NULL, 0);
+#endif
+	}
+	m_waiters.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void SpinMutex::unlock() {
+	if (m_state.exchange(UNLOCKED, std::memory_order_release) == SLEEPERS) {
+#ifndef _WIN32
+		syscall(SYS_futex, reinterpret_cast<int*>(&m_state), FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+#endif
+	}
+}
+
+CohortLock::CohortLock(int nodes)
+	: m_nodes(nodes > 0 ? nodes : nodeCount())
+	, m_owner(0)
+{
+	m_locals = new Local[m_nodes];
+}
+
+CohortLock::~CohortLock() {
+	delete[] m_locals;
+}
+
+void CohortLock::lock() {
+	int node = currentNode() % m_nodes;
+	Local& local = m_locals[node];
+	local.lock.lock();
+	if (!local.globalHeld) {
+		// only one thread per node waits on the global lock, so its waiters
+		// are other nodes; without this we would barge past them
+		while (m_owner.load(std::memory_order_relaxed) == node && m_global.hasWaiters()) {
+			yieldThread();
+		}
+		m_global.lock();
+	}
+	m_owner.store(node, std::memory_order_relaxed);
+}
+
+void CohortLock::unlock() {
+	Local& local = m_locals[m_owner.load(std::memory_order_relaxed)];
+	if (local.lock.hasWaiters() && local.passes < MAX_PASSES) {
+		local.passes++;
+		local.globalHeld = true;
+	} else {
+		local.passes = 0;
+		local.globalHeld = false;
+		m_global.unlock();
+	}
+	local.lock.unlock();
+}
+
+int CohortLock::currentNode() {
+	size_t node = s_curNode.get();
+	if (!node) {
+#ifdef _WIN32
+		UCHAR n = 0;
+		::GetNumaProcessorNode(UCHAR(::GetCurrentProcessorNumber()), &n);
+		node = size_t(n) + 1;
+#else
+		int cpu = sched_getcpu();
+		int n = cpu >= 0 && numa_available() >= 0 ? numa_node_of_cpu(cpu) : 0;
+		node = size_t(n < 0 ? 0 : n) + 1;
+#endif
+		s_curNode.set(node);
+	}
+	return int(node - 1);
+}
+
+void CohortLock::setCurrentNode(int node) {
+	s_curNode.set(size_t(node) + 1);
+}
+
+}
+}
@@ -1,4 +1,6 @@
 #include "coroutine.h"
+#include "trace.h"
+#include "mempool.h"
 #include <cassert>
 
 void coroutine::resume(coroutine_schedule* schedule) {
@@ -10,14 +12,33 @@ void coroutine::reset(coroutine_func_t func, void* ud) {
 	m_ud = ud;
 	m_status = READY;
 	m_initTime++;
+	m_runTicks = 0;
 }
 
 void coroutine::yield() {
 	m_schedule->yield(this);
 }
 
+void coroutine::park(coroutine_hook_t hook, void* ctx) {
+	m_status = WAITING;
+	m_parkHook = hook;
+	m_parkCtx = ctx;
+	m_schedule->yield(this);
+}
+
+static coroutine::status_t afterSwitch(coroutine* co, coroutine_hook_t& hook, void* ctx) {
+	coroutine::status_t status = co->status();
+	if (hook) {
+		coroutine_hook_t h = hook;
+		hook = NULL;
+		h(ctx);
+	}
+	return status;
+}
+
 void coroutine::fiber_routine() {
 	while (!m_Exit) {
+		NUMA_TRACE_EVENT(START, this);
 		m_func(m_ud);
 		m_status = coroutine::READY;
 		yield();
@@ -28,12 +49,27 @@ void coroutine::fiber_routine() {
 
 #ifdef _WIN32
 
+// fibers allocate their own stacks, node placement is left to first touch
+coroutine* coroutine::create(coroutine_func_t func, void* ud, int) {
+	return new coroutine(func, ud);
+}
+
+void coroutine::destroy(coroutine* co) {
+	delete co;
+}
+
 coroutine::coroutine(coroutine_func_t func, void* ud)
 	: m_func(func)
 	, m_ud(ud)
 	, m_status(READY)
 	, m_Exit(false)
 	, m_initTime(1)
+	, m_parkHook(NULL)
+	, m_parkCtx(NULL)
+	, m_queuedAt(0)
+	, m_runTicks(0)
+	, m_home(NULL)
+	, m_homeWorker(-1)
 {
 	// Ĭ4Kջռ䣬Ϊ1Mջռ
 	m_fiber = ::CreateFiberEx(64 * 1024, coroutine_schedule::STACK_SIZE, FIBER_FLAG_FLOAT_SWITCH, 
@@ -66,22 +102,82 @@ void coroutine_schedule::yield(coroutine* co) const {
 	::SwitchToFiber(m_fiber);
 }
 
-void coroutine_schedule::resume(coroutine* co) {
+coroutine::status_t coroutine_schedule::resume(coroutine* co) {
 	co->m_status = coroutine::RUNNING;
 	co->m_schedule = this;
 	m_running = co;
 	::SwitchToFiber(co->m_fiber);
+	return afterSwitch(co, co->m_parkHook, co->m_parkCtx);
 }
 
 #else
 
+coroutine* coroutine::create(coroutine_func_t func, void* ud, int node) {
+	if (node < 0) {
+		return new coroutine(func, ud);
+	}
+	size_t head = MEM_ALIGN(sizeof(coroutine), 4096);
+	size_t size = head + coroutine_schedule::STACK_SIZE;
+	char* mem = static_cast<char*>(numa_alloc_onnode(size, node));
+	if (!mem) {
+		return new coroutine(func, ud);
+	}
+	coroutine* co = ::new (mem) coroutine(func, ud, mem + head);
+	co->m_mapping = mem;
+	co->m_mappingSize = size;
+	return co;
+}
+
+void coroutine::destroy(coroutine* co) {
+	if (!co->m_mapping) {
+		delete co;
+		return;
+	}
+	void* mem = co->m_mapping;
+	size_t size = co->m_mappingSize;
+	co->~coroutine();
+	numa_free(mem, size);
+}
+
 coroutine::coroutine(coroutine_func_t func, void* ud)
 	: m_func(func)
 	, m_ud(ud)
+	, m_status(READY)
 	, m_Exit(false)
 	, m_initTime(1)
+	, m_parkHook(NULL)
+	, m_parkCtx(NULL)
+	, m_queuedAt(0)
+	, m_runTicks(0)
+	, m_home(NULL)
+	, m_homeWorker(-1)
+	, stack(new char[coroutine_schedule::STACK_SIZE])
+	, m_mapping(NULL)
+	, m_mappingSize(0)
 {
-	stack = new char[coroutine_schedule::STACK_SIZE];
+	init();
+}
+
+coroutine::coroutine(coroutine_func_t func, void* ud, char* stackMem)
+	: m_func(func)
+	, m_ud(ud)
+	, m_status(READY)
+	, m_Exit(false)
+	, m_initTime(1)
+	, m_parkHook(NULL)
+	, m_parkCtx(NULL)
+	, m_queuedAt(0)
+	, m_runTicks(0)
+	, m_home(NULL)
+	, m_homeWorker(-1)
+	, stack(stackMem)
+	, m_mapping(NULL)
+	, m_mappingSize(0)
+{
+	init();
+}
+
+void coroutine::init() {
 	getcontext(&m_ctx);
 	m_ctx.uc_stack.ss_sp = stack;
 	m_ctx.uc_stack.ss_size = coroutine_schedule::STACK_SIZE;
@@ -91,7 +187,9 @@ coroutine::coroutine(coroutine_func_t func, void* ud)
 }
 
 coroutine::~coroutine() {
-	delete []stack;
+	if (!m_mapping) {
+		delete []stack;
+	}
 }
 
 void coroutine::s_fiber_routine(uint32_t low32, uint32_t hi32) {
@@ -120,12 +218,13 @@ void coroutine_schedule::yield(coroutine* co) const {
 	swapcontext(&co->m_ctx, &main);
 }
 
-void coroutine_schedule::resume(coroutine* co) {
+coroutine::status_t coroutine_schedule::resume(coroutine* co) {
 	co->m_status = coroutine::RUNNING;
 	co->m_schedule = this;
 	m_running = co;
 	
 	swapcontext(&main, &co->m_ctx);
+	return afterSwitch(co, co->m_parkHook, co->m_parkCtx);
 }
 
 #endif
@@ -0,0 +1,68 @@
+#include "future.h"
+
+namespace Task {
+namespace detail {
+
+namespace {
+	struct CoroutineWaiter {
+		FutureCallback cb;
+		FutureState* state;
+		coroutine* co;
+	};
+
+	void s_wakeCoroutine(FutureCallback* cb) {
+		CoroutineWaiter* w = reinterpret_cast<CoroutineWaiter*>(cb->ctx);
+		Pool::wake(w->co);
+	}
+
+	// runs once the waiter is off its stack, see coroutine::park
+	void s_parkWaiter(void* ctx) {
+		CoroutineWaiter* w = reinterpret_cast<CoroutineWaiter*>(ctx);
+		w->state->addCallback(&w->cb);
+	}
+
+	struct ThreadWaiter {
+		FutureCallback cb;
+		sys::Semaphore sem;
+	};
+
+	void s_wakeThread(FutureCallback* cb) {
+		reinterpret_cast<ThreadWaiter*>(cb->ctx)->sem.up();
+	}
+}
+
+void FutureState::wait() {
+	if (ready()) {
+		return;
+	}
+	NUMA_TRACE_EVENT(WAIT_FUTURE, this);
+	Pool* pool = curPool.get();
+	if (pool) {
+		CoroutineWaiter w;
+		w.cb.fn = s_wakeCoroutine;
+		w.cb.ctx = &w;
+		w.state = this;
+		w.co = Pool::getRunningTask();
+		w.co->park(s_parkWaiter, &w);
+	} else {
+		ThreadWaiter w;
+		w.cb.fn = s_wakeThread;
+		w.cb.ctx = &w;
+		addCallback(&w.cb);
+		w.sem.down();
+	}
+}
+
+void schedule(Pool* fallback, coroutine_func_t func, void* ud) {
+	Pool* pool = curPool.get();
+	if (pool) {
+		pool->addContinuation(func, ud, Pool::currentWorker());
+	} else if (fallback) {
+		fallback->addContinuation(func, ud);
+	} else {
+		func(ud);
+	}
+}
+
+}
+}
@@ -0,0 +1,129 @@
+#include "handoff.h"
+
+namespace Task {
+
+// entries a drain task hands over before letting others run
+static const size_t DRAIN_BUDGET = 256;
+
+static size_t ringSize(size_t capacity) {
+	size_t size = 1;
+	while (size < capacity) {
+		size <<= 1;
+	}
+	return size;
+}
+
+Handoff::Handoff(NUMAExecutorGroup& dst, size_t capacity)
+	: m_dst(dst)
+	, m_ring(new detail::ChannelRing<Entry>(ringSize(capacity), &dst))
+	, m_scheduled(false)
+{
+	static_assert(detail::ChannelRing<Entry>::CELL_SIZE == CACHE_LINE_SIZE, "handoff entries should fill a cache line");
+}
+
+Handoff::~Handoff() {
+	while (m_scheduled.load(std::memory_order_acquire) || m_ring->size()) {
+		if (curPool.get()) {
+			Pool::getRunningTask()->yield();
+		} else {
+			sys::yieldThread();
+		}
+	}
+	delete m_ring;
+}
+
+void Handoff::push(Entry* entries, size_t count) {
+	while (count) {
+		size_t n = m_ring->tryPushBatch(entries, count);
+		if (n) {
+			entries += n;
+			count -= n;
+			schedule();
+		} else if (curPool.get()) {
+			Pool::getRunningTask()->yield();
+		} else {
+			sys::yieldThread();
+		}
+	}
+}
+
+void Handoff::schedule() {
+	// pairs with the fence in drain()
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (!m_scheduled.exchange(true, std::memory_order_acq_rel)) {
+		// carries work that is already sent, admission applies to the entries
+		m_dst.taskPool().addContinuation(s_drain, this);
+	}
+}
+
+void Handoff::s_drain(void* ctx) {
+	static_cast<Handoff*>(ctx)->drain();
+}
+
+void Handoff::drain() {
+	Pool& pool = m_dst.taskPool();
+	for (;;) {
+		Entry e;
+		size_t n = 0;
+		while (n < DRAIN_BUDGET && m_ring->tryPop(e)) {
+			// refused by admission control: the entry, and the ring behind
+			// it, wait until the pool has room
+			while (!handOver(pool, e)) {
+				io::sleep(1);
+			}
+			n++;
+		}
+		if (n == DRAIN_BUDGET) {
+			Pool::getRunningTask()->yield();
+			continue;
+		}
+		m_scheduled.store(false, std::memory_order_release);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		// a sender that saw us still scheduled left its entries to us; one
+		// still writing its entries schedules a drain of its own
+		if (!m_ring->ready() || m_scheduled.exchange(true, std::memory_order_acq_rel)) {
+			return;
+		}
+	}
+}
+
+bool Handoff::handOver(Pool& pool, Entry& e) {
+	// the drain task only relays, it does not take an admission slot away
+	// from the entries
+	if (e.size) {
+		return pool.addRelayedTask([e]() mutable {
+			e.func(e.payload);
+		});
+	}
+	return pool.addRelayedTask(e.func, e.ud);
+}
+
+HandoffMesh::HandoffMesh(const std::vector<NUMAExecutorGroup*>& groups, size_t capacity)
+	: m_groups(groups)
+{
+	for (size_t src = 0; src < groups.size(); src++) {
+		for (size_t dst = 0; dst < groups.size(); dst++) {
+			m_links.push_back(new Handoff(*groups[dst], capacity));
+		}
+	}
+}
+
+HandoffMesh::~HandoffMesh() {
+	for (size_t i = 0; i < m_links.size(); i++) {
+		delete m_links[i];
+	}
+}
+
+Handoff& HandoffMesh::to(size_t dst) {
+	NUMAExecutorGroup* self = curExecutorGroup.get();
+	size_t src = 0;
+	for (size_t i = 0; i < m_groups.size(); i++) {
+		if (m_groups[i] == self) {
+			src = i;
+			break;
+		}
+	}
+	return link(src, dst);
+}
+
+}
@@ -0,0 +1,106 @@
+#include "metrics.h"
+
+namespace Task {
+
+void HistogramSnapshot::add(const Histogram& h) {
+	for (int i = 0; i < Histogram::BUCKETS; i++) {
+		uint64_t c = h.count(i);
+		m_counts[i] += c;
+		m_total += c;
+	}
+	m_sum += h.sum();
+}
+
+void HistogramSnapshot::merge(const HistogramSnapshot& rhs) {
+	for (int i = 0; i < Histogram::BUCKETS; i++) {
+		m_counts[i] += rhs.m_counts[i];
+	}
+	m_total += rhs.m_total;
+	m_sum += rhs.m_sum;
+}
+
+double HistogramSnapshot::mean() const {
+	if (!m_total) {
+		return 0;
+	}
+	return double(m_sum) / double(m_total) * 1000.0 / Trace::ticksPerUs();
+}
+
+double HistogramSnapshot::percentile(double p) const {
+	if (!m_total) {
+		return 0;
+	}
+	uint64_t rank = uint64_t(p * double(m_total));
+	if (rank >= m_total) {
+		rank = m_total - 1;
+	}
+	uint64_t seen = 0;
+	int i = 0;
+	for (; i < Histogram::BUCKETS - 1; i++) {
+		seen += m_counts[i];
+		if (seen > rank) {
+			break;
+		}
+	}
+	return double(Histogram::lowerBound(i)) * 1000.0 / Trace::ticksPerUs();
+}
+
+WorkerStats::WorkerStats()
+	: tasksRun(0)
+	, resumes(0)
+	, steals(0)
+	, failedSteals(0)
+	, parks(0)
+	, unparks(0)
+	, coroutinesCreated(0)
+	, coroutinesRecycled(0)
+	, coroutinesFreed(0)
+	, tasksRejected(0)
+{}
+
+WorkerMetrics::WorkerMetrics()
+	: tasksRun(0)
+	, resumes(0)
+	, steals(0)
+	, failedSteals(0)
+	, parks(0)
+	, unparks(0)
+	, coroutinesCreated(0)
+	, coroutinesRecycled(0)
+	, coroutinesFreed(0)
+	, tasksRejected(0)
+	, queueDepth(0)
+{}
+
+void WorkerMetrics::add(const WorkerStats& s) {
+	tasksRun += s.tasksRun.load(std::memory_order_relaxed);
+	resumes += s.resumes.load(std::memory_order_relaxed);
+	steals += s.steals.load(std::memory_order_relaxed);
+	failedSteals += s.failedSteals.load(std::memory_order_relaxed);
+	parks += s.parks.load(std::memory_order_relaxed);
+	unparks += s.unparks.load(std::memory_order_relaxed);
+	coroutinesCreated += s.coroutinesCreated.load(std::memory_order_relaxed);
+	coroutinesRecycled += s.coroutinesRecycled.load(std::memory_order_relaxed);
+	coroutinesFreed += s.coroutinesFreed.load(std::memory_order_relaxed);
+	tasksRejected += s.tasksRejected.load(std::memory_order_relaxed);
+	queueWait.add(s.queueWait);
+	runTime.add(s.runTime);
+}
+
+void WorkerMetrics::merge(const WorkerMetrics& rhs) {
+	tasksRun += rhs.tasksRun;
+	resumes += rhs.resumes;
+	steals += rhs.steals;
+	failedSteals += rhs.failedSteals;
+	parks += rhs.parks;
+	unparks += rhs.unparks;
+	coroutinesCreated += rhs.coroutinesCreated;
+	coroutinesRecycled += rhs.coroutinesRecycled;
+	coroutinesFreed += rhs.coroutinesFreed;
+	tasksRejected += rhs.tasksRejected;
+	queueDepth += rhs.queueDepth;
+	queueWait.merge(rhs.queueWait);
+	runTime.merge(rhs.runTime);
+}
+
+}
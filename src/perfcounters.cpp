@@ -0,0 +1,136 @@
+#include "perfcounters.h"
+#ifndef _WIN32
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cstring>
+#endif
+
+namespace Task {
+
+namespace {
+#ifndef _WIN32
+	struct CounterConfig {
+		uint32_t type;
+		uint64_t config;
+	};
+
+	uint64_t cacheConfig(uint64_t cache, uint64_t result) {
+		return cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (result << 16);
+	}
+
+	// the node cache event counts reads reaching memory: accesses are all
+	// of them, misses the ones a remote node served. LOCAL_DRAM is opened
+	// as accesses and read as accesses - misses.
+	const CounterConfig s_configs[PerfCounters::COUNTER_COUNT] = {
+		{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+		{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+		{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+		{ PERF_TYPE_HW_CACHE, cacheConfig(PERF_COUNT_HW_CACHE_NODE, PERF_COUNT_HW_CACHE_RESULT_ACCESS) },
+		{ PERF_TYPE_HW_CACHE, cacheConfig(PERF_COUNT_HW_CACHE_NODE, PERF_COUNT_HW_CACHE_RESULT_MISS) },
+	};
+
+	int openCounter(const CounterConfig& c, int leader) {
+		perf_event_attr attr;
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = c.type;
+		attr.config = c.config;
+		attr.disabled = leader == -1 ? 1 : 0;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		attr.read_format = PERF_FORMAT_GROUP;
+		return int(syscall(SYS_perf_event_open, &attr, 0, -1, leader, 0));
+	}
+#endif
+}
+
+PerfCounters::PerfCounters()
+	: m_opened(0)
+	, m_available(0)
+{
+	for (int i = 0; i < COUNTER_COUNT; i++) {
+		m_fds[i] = -1;
+		m_order[i] = -1;
+	}
+}
+
+PerfCounters::~PerfCounters() {
+	close();
+}
+
+bool PerfCounters::open() {
+	close();
+#ifndef _WIN32
+	int leader = -1;
+	for (int i = 0; i < COUNTER_COUNT; i++) {
+		int fd = openCounter(s_configs[i], leader);
+		if (fd < 0) {
+			continue;
+		}
+		if (leader == -1) {
+			leader = fd;
+		}
+		m_fds[i] = fd;
+		m_order[m_opened++] = i;
+		m_available |= 1u << i;
+	}
+	if (leader != -1) {
+		ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+	}
+	// without misses the local share is unknown
+	if (!(m_available & (1u << REMOTE_DRAM))) {
+		m_available &= ~(1u << LOCAL_DRAM);
+	}
+#endif
+	return m_available != 0;
+}
+
+void PerfCounters::close() {
+#ifndef _WIN32
+	for (int i = 0; i < COUNTER_COUNT; i++) {
+		if (m_fds[i] >= 0) {
+			::close(m_fds[i]);
+		}
+		m_fds[i] = -1;
+		m_order[i] = -1;
+	}
+#endif
+	m_opened = 0;
+	m_available = 0;
+}
+
+bool PerfCounters::read(Sample& out) const {
+	if (!m_opened) {
+		return false;
+	}
+#ifndef _WIN32
+	// PERF_FORMAT_GROUP: the count, then one value per member in open order
+	uint64_t buf[COUNTER_COUNT + 1];
+	ssize_t len = ::read(m_fds[m_order[0]], buf, sizeof(buf));
+	if (len < ssize_t(sizeof(uint64_t)) || buf[0] != uint64_t(m_opened)) {
+		return false;
+	}
+	for (int i = 0; i < m_opened; i++) {
+		out.values[m_order[i]] = buf[i + 1];
+	}
+	if (m_available & (1u << LOCAL_DRAM)) {
+		out.values[LOCAL_DRAM] -= out.values[REMOTE_DRAM];
+	} else {
+		out.values[LOCAL_DRAM] = 0;
+	}
+	return true;
+#else
+	return false;
+#endif
+}
+
+const char* PerfCounters::name(int counter) {
+	static const char* names[] = {
+		"cycles", "instructions", "llc misses", "local dram", "remote dram"
+	};
+	return counter >= 0 && counter < COUNTER_COUNT ? names[counter] : "unknown";
+}
+
+}
@@ -0,0 +1,499 @@
+#include "taskpool.h"
+#include "reactor.h"
+#include <cstring>
+#include <cstdlib>
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+
+namespace Task {
+
+static const int MAX_EVENTS = 64;
+
+long long Reactor::now() {
+#ifdef _WIN32
+	return (long long)::GetTickCount64();
+#else
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+#endif
+}
+
+void Reactor::suspend(coroutine* co) {
+	m_pending++;
+	co->setWaiting();
+	co->yield();
+}
+
+void Reactor::sleep(int ms) {
+	coroutine* co = Pool::getRunningTask();
+	Timer t;
+	t.deadline = now() + (ms > 0 ? ms : 0);
+	t.seq = m_timerSeq++;
+	t.co = co;
+	m_timers.push(t);
+	NUMA_TRACE_EVENT(WAIT_IO, -1);
+	suspend(co);
+}
+
+int Reactor::nextTimeout(int timeoutMs) const {
+	if (m_timers.empty()) {
+		return timeoutMs;
+	}
+	long long d = m_timers.top().deadline - now();
+	if (d < 0) {
+		d = 0;
+	}
+	if (timeoutMs < 0 || d < timeoutMs) {
+		return int(d);
+	}
+	return timeoutMs;
+}
+
+void Reactor::expireTimers(coroutineListType& ready) {
+	if (m_timers.empty()) {
+		return;
+	}
+	long long cur = now();
+	while (!m_timers.empty() && m_timers.top().deadline <= cur) {
+		ready.push_back(m_timers.top().co);
+		m_timers.pop();
+		m_pending--;
+	}
+}
+
+#ifdef _WIN32
+
+Reactor::Reactor(bool)
+	: m_backend(EPOLL)
+	, m_pending(0)
+	, m_timerSeq(0)
+{}
+
+Reactor::~Reactor() {
+}
+
+void Reactor::notify() {
+	m_wakeup.up();
+}
+
+void Reactor::poll(int timeoutMs, coroutineListType& ready) {
+	expireTimers(ready);
+	m_wakeup.timedDown(ready.empty() ? nextTimeout(timeoutMs) : 0);
+	expireTimers(ready);
+}
+
+#else
+
+Reactor::Reactor(bool useUring)
+	: m_backend(EPOLL)
+	, m_pending(0)
+	, m_timerSeq(0)
+{
+	memset(&m_ring, 0, sizeof(m_ring));
+	m_ring.fd = -1;
+	m_epollFd = epoll_create1(EPOLL_CLOEXEC);
+	m_eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (m_epollFd < 0 || m_eventFd < 0) {
+		throw std::bad_alloc();
+	}
+	epoll_event ev;
+	ev.events = EPOLLIN;
+	ev.data.fd = m_eventFd;
+	epoll_ctl(m_epollFd, EPOLL_CTL_ADD, m_eventFd, &ev);
+#ifndef NUMA_DISABLE_IO_URING
+	if (useUring && !getenv("NUMA_NO_IO_URING") && setupUring()) {
+		m_backend = IO_URING;
+	}
+#endif
+}
+
+Reactor::~Reactor() {
+	closeUring();
+	::close(m_eventFd);
+	::close(m_epollFd);
+}
+
+void Reactor::notify() {
+	uint64_t one = 1;
+	ssize_t ret = ::write(m_eventFd, &one, sizeof(one));
+	(void)ret;
+}
+
+void Reactor::poll(int timeoutMs, coroutineListType& ready) {
+	size_t before = ready.size();
+	uringSubmit();
+	uringReap(ready);
+	expireTimers(ready);
+	if (ready.size() != before) {
+		timeoutMs = 0;
+	}
+	epoll_event events[MAX_EVENTS];
+	int n = epoll_wait(m_epollFd, events, MAX_EVENTS, nextTimeout(timeoutMs));
+	for (int i = 0; i < n; i++) {
+		if (events[i].data.fd == m_eventFd) {
+			uint64_t cnt;
+			ssize_t ret = ::read(m_eventFd, &cnt, sizeof(cnt));
+			(void)ret;
+		} else {
+			dispatchFd(events[i].data.fd, events[i].events, ready);
+		}
+	}
+	uringReap(ready);
+	expireTimers(ready);
+}
+
+static bool isNonBlocking(int fd) {
+	int flags = fcntl(fd, F_GETFL);
+	return flags != -1 && (flags & O_NONBLOCK);
+}
+
+// false when the fd cannot be waited on (regular files), the caller then
+// just issues the syscall. Coroutines waiting in the same direction queue
+// up and are resumed one per readiness event.
+bool Reactor::waitFd(int fd, bool write) {
+	coroutine* co = Pool::getRunningTask();
+	std::map<int, FdWait>::iterator it = m_fdWaits.find(fd);
+	bool registered = it != m_fdWaits.end();
+	if (!registered || (write ? it->second.writers : it->second.readers).empty()) {
+		unsigned int events = write ? EPOLLOUT : EPOLLIN;
+		if (registered) {
+			events |= interest(it->second);
+		}
+		epoll_event ev;
+		ev.events = events | EPOLLONESHOT;
+		ev.data.fd = fd;
+		if (epoll_ctl(m_epollFd, registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, fd, &ev) != 0) {
+			return false;
+		}
+	}
+	FdWait& w = m_fdWaits[fd];
+	(write ? w.writers : w.readers).push_back(co);
+	NUMA_TRACE_EVENT(WAIT_IO, fd);
+	suspend(co);
+	return true;
+}
+
+unsigned int Reactor::interest(const FdWait& w) {
+	return (w.readers.empty() ? 0 : EPOLLIN) | (w.writers.empty() ? 0 : EPOLLOUT);
+}
+
+void Reactor::dispatchFd(int fd, unsigned int events, coroutineListType& ready) {
+	std::map<int, FdWait>::iterator it = m_fdWaits.find(fd);
+	if (it == m_fdWaits.end()) {
+		return;
+	}
+	FdWait& w = it->second;
+	// on errors everybody gets to see the failing call
+	bool err = (events & (EPOLLERR | EPOLLHUP)) != 0;
+	coroutineListType* lists[2] = { &w.readers, &w.writers };
+	const unsigned int dirs[2] = { EPOLLIN, EPOLLOUT };
+	for (int d = 0; d < 2; d++) {
+		coroutineListType& list = *lists[d];
+		while (!list.empty() && (err || (events & dirs[d]))) {
+			coroutine* co = list.front();
+			list.pop_front();
+			ready.push_back(co);
+			m_pending--;
+			if (!err) {
+				break;
+			}
+		}
+	}
+	unsigned int left = interest(w);
+	if (left) {
+		epoll_event ev;
+		ev.events = left | EPOLLONESHOT;
+		ev.data.fd = fd;
+		epoll_ctl(m_epollFd, EPOLL_CTL_MOD, fd, &ev);
+	} else {
+		epoll_ctl(m_epollFd, EPOLL_CTL_DEL, fd, NULL);
+		m_fdWaits.erase(it);
+	}
+}
+
+static ssize_t ioResult(long long res) {
+	if (res < 0) {
+		errno = int(-res);
+		return -1;
+	}
+	return ssize_t(res);
+}
+
+ssize_t Reactor::read(int fd, void* buf, size_t len, off_t offset) {
+	if (uringAvailable()) {
+		return ioResult(uringCall(IORING_OP_READ, fd, buf, (unsigned int)len,
+			offset < 0 ? ~0ULL : (unsigned long long)offset, 0));
+	}
+	bool nonblock = isNonBlocking(fd);
+	if (!nonblock) {
+		waitFd(fd, false);
+	}
+	for (;;) {
+		ssize_t n = offset < 0 ? ::read(fd, buf, len) : ::pread(fd, buf, len, offset);
+		if (n >= 0 || !nonblock || (errno != EAGAIN && errno != EWOULDBLOCK) || !waitFd(fd, false)) {
+			return n;
+		}
+	}
+}
+
+ssize_t Reactor::write(int fd, const void* buf, size_t len, off_t offset) {
+	if (uringAvailable()) {
+		return ioResult(uringCall(IORING_OP_WRITE, fd, const_cast<void*>(buf), (unsigned int)len,
+			offset < 0 ? ~0ULL : (unsigned long long)offset, 0));
+	}
+	bool nonblock = isNonBlocking(fd);
+	if (!nonblock) {
+		waitFd(fd, true);
+	}
+	for (;;) {
+		ssize_t n = offset < 0 ? ::write(fd, buf, len) : ::pwrite(fd, buf, len, offset);
+		if (n >= 0 || !nonblock || (errno != EAGAIN && errno != EWOULDBLOCK) || !waitFd(fd, true)) {
+			return n;
+		}
+	}
+}
+
+int Reactor::accept(int fd, sockaddr* addr, socklen_t* addrlen) {
+	if (uringAvailable()) {
+		return int(ioResult(uringCall(IORING_OP_ACCEPT, fd, addr, 0, 0, (unsigned long long)(uintptr_t)addrlen)));
+	}
+	bool nonblock = isNonBlocking(fd);
+	if (!nonblock) {
+		waitFd(fd, false);
+	}
+	for (;;) {
+		int n = ::accept(fd, addr, addrlen);
+		if (n >= 0 || !nonblock || (errno != EAGAIN && errno != EWOULDBLOCK) || !waitFd(fd, false)) {
+			return n;
+		}
+	}
+}
+
+bool Reactor::setupUring() {
+	io_uring_params p;
+	memset(&p, 0, sizeof(p));
+	int fd = (int)syscall(__NR_io_uring_setup, 256, &p);
+	if (fd < 0) {
+		return false;
+	}
+	m_ring.fd = fd;
+	m_ring.entries = p.sq_entries;
+	m_ring.cqEntries = p.cq_entries;
+
+	// IORING_OP_READ/WRITE/ACCEPT need 5.6, probe before relying on them
+	size_t probeSize = sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op);
+	io_uring_probe* probe = static_cast<io_uring_probe*>(::calloc(1, probeSize));
+	bool supported = probe && syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, 256) == 0;
+	const int ops[] = { IORING_OP_READ, IORING_OP_WRITE, IORING_OP_ACCEPT };
+	for (size_t i = 0; supported && i < sizeof(ops) / sizeof(ops[0]); i++) {
+		supported = ops[i] <= probe->last_op && (probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED);
+	}
+	::free(probe);
+	if (!supported) {
+		closeUring();
+		return false;
+	}
+
+	m_ring.sqRingSize = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	m_ring.cqRingSize = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+	bool single = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+	if (single) {
+		if (m_ring.cqRingSize > m_ring.sqRingSize) {
+			m_ring.sqRingSize = m_ring.cqRingSize;
+		}
+		m_ring.cqRingSize = m_ring.sqRingSize;
+	}
+	m_ring.sqRing = mmap(0, m_ring.sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	if (m_ring.sqRing == MAP_FAILED) {
+		m_ring.sqRing = NULL;
+		closeUring();
+		return false;
+	}
+	if (single) {
+		m_ring.cqRing = m_ring.sqRing;
+	} else {
+		m_ring.cqRing = mmap(0, m_ring.cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+		if (m_ring.cqRing == MAP_FAILED) {
+			m_ring.cqRing = NULL;
+			closeUring();
+			return false;
+		}
+	}
+	m_ring.sqesSize = p.sq_entries * sizeof(io_uring_sqe);
+	m_ring.sqes = mmap(0, m_ring.sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+	if (m_ring.sqes == MAP_FAILED) {
+		m_ring.sqes = NULL;
+		closeUring();
+		return false;
+	}
+	char* sq = static_cast<char*>(m_ring.sqRing);
+	char* cq = static_cast<char*>(m_ring.cqRing);
+	m_ring.sqHead = reinterpret_cast<unsigned int*>(sq + p.sq_off.head);
+	m_ring.sqTail = reinterpret_cast<unsigned int*>(sq + p.sq_off.tail);
+	m_ring.sqMask = reinterpret_cast<unsigned int*>(sq + p.sq_off.ring_mask);
+	m_ring.sqArray = reinterpret_cast<unsigned int*>(sq + p.sq_off.array);
+	m_ring.cqHead = reinterpret_cast<unsigned int*>(cq + p.cq_off.head);
+	m_ring.cqTail = reinterpret_cast<unsigned int*>(cq + p.cq_off.tail);
+	m_ring.cqMask = reinterpret_cast<unsigned int*>(cq + p.cq_off.ring_mask);
+	m_ring.cqes = cq + p.cq_off.cqes;
+
+	// completions kick the eventfd, so epoll_wait remains the only place the worker sleeps
+	if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_EVENTFD, &m_eventFd, 1) != 0) {
+		closeUring();
+		return false;
+	}
+	return true;
+}
+
+void Reactor::closeUring() {
+	if (m_ring.sqes) {
+		munmap(m_ring.sqes, m_ring.sqesSize);
+	}
+	if (m_ring.cqRing && m_ring.cqRing != m_ring.sqRing) {
+		munmap(m_ring.cqRing, m_ring.cqRingSize);
+	}
+	if (m_ring.sqRing) {
+		munmap(m_ring.sqRing, m_ring.sqRingSize);
+	}
+	if (m_ring.fd >= 0) {
+		::close(m_ring.fd);
+	}
+	memset(&m_ring, 0, sizeof(m_ring));
+	m_ring.fd = -1;
+}
+
+// keep in-flight requests below the CQ size so completions never overflow,
+// and never reuse an SQE the kernel has not consumed yet; past either limit
+// operations take the epoll path
+bool Reactor::uringAvailable() {
+	if (m_backend != IO_URING || m_ring.inflight >= m_ring.cqEntries) {
+		return false;
+	}
+	if (uringFull()) {
+		uringSubmit();
+	}
+	return !uringFull();
+}
+
+bool Reactor::uringFull() const {
+	return *m_ring.sqTail - __atomic_load_n(m_ring.sqHead, __ATOMIC_ACQUIRE) >= m_ring.entries;
+}
+
+long long Reactor::uringCall(int op, int fd, void* addr, unsigned int len, unsigned long long off, unsigned long long addr2) {
+	coroutine* co = Pool::getRunningTask();
+	assert(!uringFull());
+	Request req;
+	req.co = co;
+	req.result = 0;
+	unsigned int tail = *m_ring.sqTail;
+	unsigned int idx = tail & *m_ring.sqMask;
+	io_uring_sqe* sqe = static_cast<io_uring_sqe*>(m_ring.sqes) + idx;
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = (unsigned char)op;
+	sqe->fd = fd;
+	sqe->addr = (unsigned long long)(uintptr_t)addr;
+	sqe->len = len;
+	if (op == IORING_OP_ACCEPT) {
+		sqe->addr2 = addr2;
+	} else {
+		sqe->off = off;
+	}
+	sqe->user_data = (unsigned long long)(uintptr_t)&req;
+	m_ring.sqArray[idx] = idx;
+	__atomic_store_n(m_ring.sqTail, tail + 1, __ATOMIC_RELEASE);
+	m_ring.toSubmit++;
+	m_ring.inflight++;
+	// submitted in one batch the next time the worker polls
+	NUMA_TRACE_EVENT(WAIT_IO, fd);
+	suspend(co);
+	return req.result;
+}
+
+void Reactor::uringSubmit() {
+	while (m_ring.toSubmit) {
+		long ret = syscall(__NR_io_uring_enter, m_ring.fd, m_ring.toSubmit, 0, 0, NULL, 0);
+		if (ret < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			// EAGAIN/EBUSY: retry on the next poll
+			break;
+		}
+		m_ring.toSubmit -= (unsigned int)ret;
+	}
+}
+
+void Reactor::uringReap(coroutineListType& ready) {
+	if (m_backend != IO_URING) {
+		return;
+	}
+	unsigned int head = *m_ring.cqHead;
+	unsigned int tail = __atomic_load_n(m_ring.cqTail, __ATOMIC_ACQUIRE);
+	io_uring_cqe* cqes = static_cast<io_uring_cqe*>(m_ring.cqes);
+	while (head != tail) {
+		io_uring_cqe* cqe = &cqes[head & *m_ring.cqMask];
+		Request* req = reinterpret_cast<Request*>((uintptr_t)cqe->user_data);
+		req->result = cqe->res;
+		ready.push_back(req->co);
+		m_ring.inflight--;
+		m_pending--;
+		head++;
+	}
+	__atomic_store_n(m_ring.cqHead, head, __ATOMIC_RELEASE);
+}
+
+#endif
+
+namespace io {
+#ifndef _WIN32
+	ssize_t read(int fd, void* buf, size_t len, off_t offset) {
+		Reactor* r = curReactor.get();
+		if (r) {
+			return r->read(fd, buf, len, offset);
+		}
+		return offset < 0 ? ::read(fd, buf, len) : ::pread(fd, buf, len, offset);
+	}
+
+	ssize_t write(int fd, const void* buf, size_t len, off_t offset) {
+		Reactor* r = curReactor.get();
+		if (r) {
+			return r->write(fd, buf, len, offset);
+		}
+		return offset < 0 ? ::write(fd, buf, len) : ::pwrite(fd, buf, len, offset);
+	}
+
+	int accept(int fd, sockaddr* addr, socklen_t* addrlen) {
+		Reactor* r = curReactor.get();
+		if (r) {
+			return r->accept(fd, addr, addrlen);
+		}
+		return ::accept(fd, addr, addrlen);
+	}
+#endif
+
+	void sleep(int ms) {
+		Reactor* r = curReactor.get();
+		if (r) {
+			return r->sleep(ms);
+		}
+#ifdef _WIN32
+		::Sleep(ms);
+#else
+		usleep(useconds_t(ms) * 1000);
+#endif
+	}
+}
+
+ContextLocal<Reactor*, &WorkerContext::reactor> curReactor;
+
+}
@@ -0,0 +1,138 @@
+#include "taskgraph.h"
+
+namespace Task {
+
+TaskGraph::TaskGraph()
+	: m_dirty(false)
+	, m_acyclic(true)
+	, m_pool(NULL)
+	, m_remaining(0)
+	, m_done(NULL)
+{}
+
+TaskGraph::~TaskGraph() {
+	assert(!m_done);
+	for (size_t i = 0; i < m_nodes.size(); i++) {
+		delete m_nodes[i];
+	}
+}
+
+TaskGraph::node_t TaskGraph::addNode(coroutine_func_t func, void* ud, NUMAExecutorGroup* group) {
+	Node* n = new Node;
+	n->func = func;
+	n->ud = ud;
+	n->pool = group ? &group->taskPool() : NULL;
+	n->graph = this;
+	n->preds = 0;
+	m_nodes.push_back(n);
+	m_dirty = true;
+	return m_nodes.size() - 1;
+}
+
+void TaskGraph::addEdge(node_t from, node_t to) {
+	assert(from < m_nodes.size() && to < m_nodes.size());
+	m_nodes[from]->succ.push_back(m_nodes[to]);
+	m_nodes[to]->preds++;
+	m_dirty = true;
+}
+
+// Kahn's algorithm, only rerun after the graph changed
+bool TaskGraph::validate() {
+	if (!m_dirty) {
+		return m_acyclic;
+	}
+	m_roots.clear();
+	std::vector<Node*> order;
+	for (size_t i = 0; i < m_nodes.size(); i++) {
+		m_nodes[i]->pending.store(m_nodes[i]->preds, std::memory_order_relaxed);
+		if (m_nodes[i]->preds == 0) {
+			m_roots.push_back(m_nodes[i]);
+			order.push_back(m_nodes[i]);
+		}
+	}
+	for (size_t i = 0; i < order.size(); i++) {
+		std::vector<Node*>& succ = order[i]->succ;
+		for (size_t j = 0; j < succ.size(); j++) {
+			if (succ[j]->pending.fetch_sub(1, std::memory_order_relaxed) == 1) {
+				order.push_back(succ[j]);
+			}
+		}
+	}
+	m_acyclic = order.size() == m_nodes.size();
+	m_dirty = false;
+	return m_acyclic;
+}
+
+Future<void> TaskGraph::start(Pool& pool) {
+	if (!validate()) {
+		return Future<void>();
+	}
+	assert(!m_done);
+	m_pool = &pool;
+	m_done = new Promise<void>;
+	Future<void> res = m_done->getFuture();
+	if (m_nodes.empty()) {
+		m_remaining.store(1, std::memory_order_relaxed);
+		finish();
+		return res;
+	}
+	for (size_t i = 0; i < m_nodes.size(); i++) {
+		m_nodes[i]->pending.store(m_nodes[i]->preds, std::memory_order_relaxed);
+	}
+	m_remaining.store(m_nodes.size(), std::memory_order_release);
+	for (size_t i = 0; i < m_roots.size(); i++) {
+		Node* n = m_roots[i];
+		submit(n, n->pool ? n->pool : m_pool);
+	}
+	return res;
+}
+
+bool TaskGraph::run(Pool& pool) {
+	Future<void> done = start(pool);
+	if (!done.valid()) {
+		return false;
+	}
+	done.get();
+	return true;
+}
+
+void TaskGraph::submit(Node* n, Pool* target) {
+	target->addContinuation(s_node, n, target == curPool.get() ? Pool::currentWorker() : -1);
+}
+
+void TaskGraph::finish() {
+	if (m_remaining.fetch_sub(1, std::memory_order_acq_rel) > 1) {
+		return;
+	}
+	// the waiter may start the next run as soon as it wakes
+	Promise<void>* done = m_done;
+	m_done = NULL;
+	done->setValue();
+	delete done;
+}
+
+void TaskGraph::s_node(void* ud) {
+	Node* n = reinterpret_cast<Node*>(ud);
+	while (n) {
+		n->func(n->ud);
+		TaskGraph* graph = n->graph;
+		Node* next = NULL;
+		for (size_t i = 0; i < n->succ.size(); i++) {
+			Node* s = n->succ[i];
+			if (s->pending.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+				continue;
+			}
+			Pool* target = s->pool ? s->pool : graph->m_pool;
+			if (!next && target == curPool.get()) {
+				next = s;
+			} else {
+				graph->submit(s, target);
+			}
+		}
+		// next has not finished, so this cannot end the run while it is pending
+		graph->finish();
+		n = next;
+	}
+}
+
+}
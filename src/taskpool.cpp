@@ -1,107 +1,445 @@
 #include "taskpool.h"
+#include "NUMAExecutorGroup.h"
 
 namespace Task {
 
+void* detail::allocClosure(NUMAExecutorGroup* group, size_t size) {
+	return group ? group->alloc(size) : NUMAExecutorGroup::localAlloc(size);
+}
+
+void detail::freeClosure(void* p) {
+	NUMAExecutorGroup::localFree(p);
+}
+
 Semaphore::Semaphore(int initVal) 
-	: m_cnt(initVal)
+	: m_state(initVal * UNIT)
 {}
 
 void Semaphore::down(int count) {
-	coroutine* co = curPool.get()->getRunningTask();
-	{
-		lock_guard<sys::Mutex> _(m_lock);
-		if (m_cnt >= count) {
-			m_cnt -= count;
+	int state = m_state.load(std::memory_order_relaxed);
+	while (!(state & WAITING) && state >= count * UNIT) {
+		if (m_state.compare_exchange_weak(state, state - count * UNIT, std::memory_order_acquire, std::memory_order_relaxed)) {
 			return;
 		}
-		waitItem item;
-		item.need = count;
-		item.co = co;
-		m_waitQueue.push_back(item);
 	}
-	co->setWaiting();
-	co->yield();
+	waitItem item;
+	item.need = count;
+	item.co = curPool.get()->getRunningTask();
+	item.sem = this;
+	NUMA_TRACE_EVENT(WAIT_SEMAPHORE, this);
+	item.co->park(s_parkWaiter, &item);
+}
+
+// runs once the waiter is off its stack, see coroutine::park. An up()
+// since down() gave up may already cover it.
+void Semaphore::s_parkWaiter(void* ctx) {
+	waitItem* item = reinterpret_cast<waitItem*>(ctx);
+	Semaphore* self = item->sem;
+	coroutine* co = item->co;
+	int need = item->need * UNIT;
+	{
+		lock_guard<sys::Mutex> _(self->m_lock);
+		int state = self->m_state.load(std::memory_order_relaxed);
+		for (;;) {
+			if (!(state & WAITING) && state >= need) {
+				if (self->m_state.compare_exchange_weak(state, state - need, std::memory_order_acquire, std::memory_order_relaxed)) {
+					break;
+				}
+			} else if ((state & WAITING) || self->m_state.compare_exchange_weak(state, state | WAITING, std::memory_order_relaxed)) {
+				self->m_waitQueue.push_back(item);
+				return;
+			}
+		}
+	}
+	Pool::wake(co);
 }
 
-void Semaphore::up() {
-	coroutine * nco = 0;
+void Semaphore::up(int count) {
+	int state = m_state.load(std::memory_order_relaxed);
+	while (!(state & WAITING)) {
+		if (m_state.compare_exchange_weak(state, state + count * UNIT, std::memory_order_release, std::memory_order_relaxed)) {
+			return;
+		}
+	}
+	coroutineListType ready;
 	{
 		lock_guard<sys::Mutex> _(m_lock);
-		m_cnt ++;
-		if (!m_waitQueue.empty()) {
-			waitItem& front = m_waitQueue.front();
-			if (m_cnt >= front.need) {
-				nco = front.co;
-				m_cnt -= front.need;
+		state = m_state.fetch_add(count * UNIT, std::memory_order_release) + count * UNIT;
+		// WAITING is only set and cleared under m_lock, while it is set
+		// nobody else changes the word
+		if (state & WAITING) {
+			int avail = state / UNIT;
+			waitItem* item;
+			while ((item = m_waitQueue.front()) && avail >= item->need) {
+				avail -= item->need;
+				m_waitQueue.pop_front();
+				ready.push_back(item->co);
 			}
+			m_state.store(avail * UNIT | (m_waitQueue.empty() ? 0 : WAITING), std::memory_order_relaxed);
 		}
 	}
-	if (nco) {
-		curPool.get()->addImmediatelyTask(nco);
+	if (!ready.empty()) {
+		Pool::wakeAll(ready);
 	}
 }
 
 Event::Event(bool isTrigger) 
-	: m_status(isTrigger)
+	: m_state(isTrigger ? SIGNALED : 0)
 {}
 
 void Event::signal() {
-	coroutine * nco = 0;
+	int state = m_state.load(std::memory_order_relaxed);
+	while (!(state & WAITING)) {
+		if (state == SIGNALED || m_state.compare_exchange_weak(state, SIGNALED, std::memory_order_release, std::memory_order_relaxed)) {
+			return;
+		}
+	}
+	coroutine * nco;
 	{
 		lock_guard<sys::Mutex> _(m_lock);
-		if (m_waitQueue.empty()) {
-			m_status = true;
-		} else {
-			nco = m_waitQueue.front();
+		nco = m_waitQueue.front();
+		if (nco) {
 			m_waitQueue.pop_front();
+			if (m_waitQueue.empty()) {
+				m_state.store(0, std::memory_order_relaxed);
+			}
+		} else {
+			// an earlier signal() took the last waiter
+			state = 0;
+			m_state.compare_exchange_strong(state, SIGNALED, std::memory_order_release, std::memory_order_relaxed);
 		}
 	}
 	if (nco) {
-		curPool.get()->addImmediatelyTask(nco);
+		Pool::wake(nco);
 	}
 }
 
 void Event::wait() {
-	auto co = curPool.get()->getRunningTask();
+	int state = m_state.load(std::memory_order_relaxed);
+	if (state == SIGNALED && m_state.compare_exchange_strong(state, 0, std::memory_order_acquire, std::memory_order_relaxed)) {
+		return;
+	}
+	waitItem item;
+	item.co = curPool.get()->getRunningTask();
+	item.event = this;
+	NUMA_TRACE_EVENT(WAIT_EVENT, this);
+	item.co->park(s_parkWaiter, &item);
+}
+
+void Event::s_parkWaiter(void* ctx) {
+	waitItem* item = reinterpret_cast<waitItem*>(ctx);
+	Event* self = item->event;
+	coroutine* co = item->co;
 	{
-		lock_guard<sys::Mutex> _(m_lock);
-		if (m_status) {
-			m_status = false;
-			return;
+		lock_guard<sys::Mutex> _(self->m_lock);
+		int state = self->m_state.load(std::memory_order_relaxed);
+		for (;;) {
+			if (state == SIGNALED) {
+				if (self->m_state.compare_exchange_weak(state, 0, std::memory_order_acquire, std::memory_order_relaxed)) {
+					break;
+				}
+			} else if ((state & WAITING) || self->m_state.compare_exchange_weak(state, WAITING, std::memory_order_relaxed)) {
+				self->m_waitQueue.push_back(co);
+				return;
+			}
 		}
-		m_waitQueue.push_back(co);
 	}
-	co->setWaiting();
-	co->yield();
+	Pool::wake(co);
 }
 
 Barrier::Barrier(int waitCount) 
-	: m_cnt(0)
+	: m_state(0)
 	, m_trigger(waitCount)
 {}
 
 void Barrier::sync() {
-	auto co = curPool.get()->getRunningTask();
+	unsigned long long state = m_state.load(std::memory_order_relaxed);
+	unsigned long long next;
+	do {
+		if ((unsigned int)state + 1 >= (unsigned int)m_trigger) {
+			next = ((state >> 32) + 1) << 32;
+		} else {
+			next = state + 1;
+		}
+	} while (!m_state.compare_exchange_weak(state, next, std::memory_order_acq_rel, std::memory_order_relaxed));
+	if ((unsigned int)next == 0) {
+		// The queue is ordered by generation and only the current one still
+		// waits. Releases may take m_lock out of order, so everything older
+		// goes, not just ours.
+		coroutineListType ready;
+		{
+			lock_guard<sys::Mutex> _(m_lock);
+			unsigned int current = (unsigned int)(m_state.load(std::memory_order_relaxed) >> 32);
+			waitItem* item;
+			while ((item = m_waitQueue.front()) && item->generation != current) {
+				m_waitQueue.pop_front();
+				ready.push_back(item->co);
+			}
+		}
+		if (!ready.empty()) {
+			Pool::wakeAll(ready);
+		}
+		return;
+	}
+	waitItem item;
+	item.co = curPool.get()->getRunningTask();
+	item.barrier = this;
+	item.generation = (unsigned int)(state >> 32);
+	NUMA_TRACE_EVENT(WAIT_BARRIER, this);
+	item.co->park(s_parkWaiter, &item);
+}
+
+// waiters of a generation are only queued until it is released
+void Barrier::s_parkWaiter(void* ctx) {
+	waitItem* item = reinterpret_cast<waitItem*>(ctx);
+	Barrier* self = item->barrier;
+	coroutine* co = item->co;
+	{
+		lock_guard<sys::Mutex> _(self->m_lock);
+		if ((unsigned int)(self->m_state.load(std::memory_order_acquire) >> 32) == item->generation) {
+			self->m_waitQueue.push_back(item);
+			return;
+		}
+	}
+	Pool::wake(co);
+}
+
+namespace {
+	// contended locks are polled this often before the caller parks
+	const int SPIN_COUNT = 64;
+
+	template<class T>
+	bool spin(T* lock, bool (T::*tryLock)()) {
+		for (int i = 0; i < SPIN_COUNT; i++) {
+			sys::cpuRelax();
+			if ((lock->*tryLock)()) {
+				return true;
+			}
+		}
+		return false;
+	}
+}
+
+Mutex::Mutex()
+	: m_state(UNLOCKED)
+{}
+
+bool Mutex::tryLock() {
+	int expected = UNLOCKED;
+	return m_state.compare_exchange_strong(expected, LOCKED, std::memory_order_acquire, std::memory_order_relaxed);
+}
+
+void Mutex::lock() {
+	if (tryLock() || spin(this, &Mutex::tryLock)) {
+		return;
+	}
+	waitItem item;
+	item.co = curPool.get()->getRunningTask();
+	item.mutex = this;
+	NUMA_TRACE_EVENT(WAIT_MUTEX, this);
+	// owns the lock once resumed, unlock() hands it over
+	item.co->park(s_parkWaiter, &item);
+}
+
+// marks the lock CONTENDED so that its owner takes the slow path in unlock()
+void Mutex::s_parkWaiter(void* ctx) {
+	waitItem* item = reinterpret_cast<waitItem*>(ctx);
+	Mutex* self = item->mutex;
+	coroutine* co = item->co;
+	{
+		lock_guard<sys::Mutex> _(self->m_lock);
+		int state = self->m_state.load(std::memory_order_relaxed);
+		for (;;) {
+			if (state == UNLOCKED) {
+				if (self->m_state.compare_exchange_weak(state, LOCKED, std::memory_order_acquire, std::memory_order_relaxed)) {
+					break;
+				}
+			} else if (state == CONTENDED || self->m_state.compare_exchange_weak(state, CONTENDED, std::memory_order_relaxed)) {
+				self->m_waitQueue.push_back(co);
+				return;
+			}
+		}
+	}
+	Pool::wake(co);
+}
+
+void Mutex::unlock() {
+	int expected = LOCKED;
+	if (m_state.compare_exchange_strong(expected, UNLOCKED, std::memory_order_release, std::memory_order_relaxed)) {
+		return;
+	}
+	coroutine* nco;
 	{
 		lock_guard<sys::Mutex> _(m_lock);
-		m_cnt++;
-		if (m_cnt >= m_trigger) {
-			m_cnt -= m_trigger;
-			for(int i=1; i<m_trigger && m_waitQueue.size() > 0; i++) {
-				coroutine* nco = m_waitQueue.front();
-				curPool.get()->addImmediatelyTask(nco);
+		nco = m_waitQueue.front();
+		m_waitQueue.pop_front();
+		// stays locked, nco is the owner now
+		m_state.store(m_waitQueue.empty() ? LOCKED : CONTENDED, std::memory_order_relaxed);
+	}
+	Pool::wake(nco);
+}
+
+SharedMutex::SharedMutex()
+	: m_state(0)
+{}
+
+bool SharedMutex::tryLock() {
+	int expected = 0;
+	return m_state.compare_exchange_strong(expected, WRITER, std::memory_order_acquire, std::memory_order_relaxed);
+}
+
+bool SharedMutex::tryLockShared() {
+	int state = m_state.load(std::memory_order_relaxed);
+	while (!(state & (WRITER | WAITING))) {
+		if (m_state.compare_exchange_weak(state, state + READER, std::memory_order_acquire, std::memory_order_relaxed)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+void SharedMutex::lock() {
+	if (tryLock() || spin(this, &SharedMutex::tryLock)) {
+		return;
+	}
+	park(false);
+}
+
+void SharedMutex::lockShared() {
+	if (tryLockShared() || spin(this, &SharedMutex::tryLockShared)) {
+		return;
+	}
+	park(true);
+}
+
+void SharedMutex::unlock() {
+	release(WRITER);
+}
+
+void SharedMutex::unlockShared() {
+	release(READER);
+}
+
+void SharedMutex::park(bool shared) {
+	waitItem item;
+	item.co = curPool.get()->getRunningTask();
+	item.mutex = this;
+	item.shared = shared;
+	NUMA_TRACE_EVENT(WAIT_MUTEX, this);
+	item.co->park(s_parkWaiter, &item);
+}
+
+void SharedMutex::s_parkWaiter(void* ctx) {
+	waitItem* item = reinterpret_cast<waitItem*>(ctx);
+	SharedMutex* self = item->mutex;
+	coroutine* co = item->co;
+	{
+		lock_guard<sys::Mutex> _(self->m_lock);
+		int state = self->m_state.load(std::memory_order_relaxed);
+		for (;;) {
+			if (item->shared ? !(state & (WRITER | WAITING)) : state == 0) {
+				if (self->m_state.compare_exchange_weak(state, state + (item->shared ? READER : WRITER), std::memory_order_acquire, std::memory_order_relaxed)) {
+					break;
+				}
+			} else if ((state & WAITING) || self->m_state.compare_exchange_weak(state, state | WAITING, std::memory_order_relaxed)) {
+				self->m_waitQueue.push_back(item);
+				return;
+			}
+		}
+	}
+	Pool::wake(co);
+}
+
+// the last holder to leave finds only WAITING and hands the lock on
+void SharedMutex::release(int held) {
+	if (m_state.fetch_sub(held, std::memory_order_release) - held == WAITING) {
+		wake();
+	}
+}
+
+// Nobody can take the lock while the state is just WAITING, so it is ours
+// to give to the writer or the run of readers at the front.
+void SharedMutex::wake() {
+	coroutineListType ready;
+	{
+		lock_guard<sys::Mutex> _(m_lock);
+		int state = 0;
+		waitItem* item = m_waitQueue.front();
+		if (!item->shared) {
+			m_waitQueue.pop_front();
+			ready.push_back(item->co);
+			state = WRITER;
+		} else {
+			while (item && item->shared) {
 				m_waitQueue.pop_front();
+				ready.push_back(item->co);
+				state += READER;
+				item = m_waitQueue.front();
 			}
-			return;
 		}
-		m_waitQueue.push_back(co);
+		if (!m_waitQueue.empty()) {
+			state |= WAITING;
+		}
+		m_state.store(state, std::memory_order_relaxed);
+	}
+	while (!ready.empty()) {
+		coroutine* nco = ready.front();
+		ready.pop_front();
+		Pool::wake(nco);
+	}
+}
+
+void ConditionVariable::wait(Mutex& m) {
+	waitItem item;
+	item.co = curPool.get()->getRunningTask();
+	item.cond = this;
+	item.mutex = &m;
+	NUMA_TRACE_EVENT(WAIT_CONDITION, this);
+	item.co->park(s_parkWaiter, &item);
+	m.lock();
+}
+
+// queued before the mutex is released, a notify in between is not lost
+void ConditionVariable::s_parkWaiter(void* ctx) {
+	waitItem* item = reinterpret_cast<waitItem*>(ctx);
+	ConditionVariable* self = item->cond;
+	Mutex* m = item->mutex;
+	{
+		lock_guard<sys::Mutex> _(self->m_lock);
+		self->m_waitQueue.push_back(item->co);
+	}
+	m->unlock();
+}
+
+void ConditionVariable::notifyOne() {
+	coroutine* nco;
+	{
+		lock_guard<sys::Mutex> _(m_lock);
+		nco = m_waitQueue.front();
+		if (nco) {
+			m_waitQueue.pop_front();
+		}
+	}
+	if (nco) {
+		Pool::wake(nco);
+	}
+}
+
+void ConditionVariable::notifyAll() {
+	coroutineListType waiters;
+	{
+		lock_guard<sys::Mutex> _(m_lock);
+		waiters.swap(m_waitQueue);
+	}
+	while (!waiters.empty()) {
+		coroutine* nco = waiters.front();
+		waiters.pop_front();
+		Pool::wake(nco);
 	}
-	co->setWaiting();
-	co->yield();
 }
 
-ThreadLocal<Pool*> curPool;
-ThreadLocal<coroutine_schedule*> curSchedule;
-ThreadLocal<size_t> curThreadId;
+ContextLocal<Pool*, &WorkerContext::pool> curPool;
+ContextLocal<coroutine_schedule*, &WorkerContext::schedule> curSchedule;
+ContextLocal<size_t, &WorkerContext::threadId> curThreadId;
 
 }
@@ -0,0 +1,249 @@
+#include "trace.h"
+#include "taskpool.h"
+#include <vector>
+#include <map>
+#include <chrono>
+#include <cstdio>
+
+namespace Task {
+
+namespace {
+	const uint64_t BUFFER_MASK = NUMA_TRACE_BUFFER_EVENTS - 1;
+
+	struct TraceEvent {
+		uint64_t tsc;
+		uint64_t arg;
+		// ticks, spans only
+		uint64_t duration;
+		uint32_t type;
+	};
+
+	// written only by its own thread. Never freed: a dump may still be
+	// reading one that changed hands.
+	struct TraceBuffer {
+		int tid;
+		int worker;
+		const void* pool;
+		// its thread is gone, the next dump is the last to show it
+		bool exited;
+		std::atomic<uint64_t> head;
+		TraceEvent events[NUMA_TRACE_BUFFER_EVENTS];
+	};
+
+	sys::Mutex s_buffersLock;
+	// live threads', and exited ones' not dumped yet
+	std::vector<TraceBuffer*> s_buffers;
+	// exited and dumped, for new threads to take
+	std::vector<TraceBuffer*> s_freeBuffers;
+	int s_nextTid = 0;
+	ThreadLocal<TraceBuffer*> s_buffer;
+	std::atomic<bool> s_calibrated(false);
+	uint64_t s_base;
+	double s_ticksPerUs = 1.0;
+
+	// moves exited buffers to the free list, s_buffersLock held
+	void releaseExited() {
+		size_t kept = 0;
+		for (size_t i = 0; i < s_buffers.size(); i++) {
+			if (s_buffers[i]->exited) {
+				s_freeBuffers.push_back(s_buffers[i]);
+			} else {
+				s_buffers[kept++] = s_buffers[i];
+			}
+		}
+		s_buffers.resize(kept);
+	}
+
+	TraceBuffer* newBuffer() {
+		TraceBuffer* b = NULL;
+		{
+			lock_guard<sys::Mutex> _(s_buffersLock);
+			if (s_freeBuffers.empty()) {
+				// nobody dumped since they exited: their events go the way
+				// of overwritten ones rather than piling up
+				releaseExited();
+			}
+			if (!s_freeBuffers.empty()) {
+				b = s_freeBuffers.back();
+				s_freeBuffers.pop_back();
+			} else {
+				b = new TraceBuffer;
+			}
+			b->tid = ++s_nextTid;
+			b->worker = Pool::currentWorker();
+			b->pool = curPool.get();
+			b->exited = false;
+			b->head.store(0, std::memory_order_relaxed);
+			s_buffers.push_back(b);
+		}
+		s_buffer.set(b);
+		return b;
+	}
+
+	const char* eventName(uint32_t type) {
+		static const char* names[] = {
+			"submit", "start", "resume", "yield", "block", "end",
+			"wait semaphore", "wait event", "wait barrier", "wait mutex", "wait condition", "wait channel", "wait future", "wait io", "wait blocking",
+			"steal", "park", "unpark", "inline"
+		};
+		return type < Trace::EVENT_COUNT ? names[type] : "unknown";
+	}
+}
+
+std::atomic<bool> Trace::s_enabled(false);
+
+static_assert((NUMA_TRACE_BUFFER_EVENTS & (NUMA_TRACE_BUFFER_EVENTS - 1)) == 0,
+	"NUMA_TRACE_BUFFER_EVENTS must be a power of two");
+
+uint64_t Trace::monotonicNs() {
+	return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+void Trace::calibrate() {
+	lock_guard<sys::Mutex> _(s_buffersLock);
+	if (s_calibrated.load(std::memory_order_relaxed)) {
+		return;
+	}
+	uint64_t t0 = monotonicNs();
+	uint64_t c0 = timestamp();
+	uint64_t t1;
+	do {
+		t1 = monotonicNs();
+	} while (t1 - t0 < 20000000);
+	uint64_t c1 = timestamp();
+	s_ticksPerUs = double(c1 - c0) * 1000.0 / double(t1 - t0);
+	s_base = c0;
+	s_calibrated.store(true, std::memory_order_release);
+}
+
+double Trace::ticksPerUs() {
+	if (!s_calibrated.load(std::memory_order_acquire)) {
+		calibrate();
+	}
+	return s_ticksPerUs;
+}
+
+void Trace::record(event_t type, uint64_t arg) {
+	uint64_t now = timestamp();
+	append(type, arg, now, 0);
+}
+
+void Trace::recordSpan(event_t type, uint64_t arg, uint64_t start) {
+	uint64_t now = timestamp();
+	append(type, arg, start, now - start);
+}
+
+void Trace::append(event_t type, uint64_t arg, uint64_t tsc, uint64_t duration) {
+	TraceBuffer* b = s_buffer.get();
+	if (!b) {
+		b = newBuffer();
+	}
+	uint64_t h = b->head.load(std::memory_order_relaxed);
+	TraceEvent& e = b->events[h & BUFFER_MASK];
+	e.tsc = tsc;
+	e.arg = arg;
+	e.duration = duration;
+	e.type = type;
+	b->head.store(h + 1, std::memory_order_release);
+}
+
+void Trace::reset() {
+	lock_guard<sys::Mutex> _(s_buffersLock);
+	releaseExited();
+	for (size_t i = 0; i < s_buffers.size(); i++) {
+		s_buffers[i]->head.store(0, std::memory_order_relaxed);
+	}
+}
+
+void Trace::threadExit() {
+	TraceBuffer* b = s_buffer.get();
+	if (!b) {
+		return;
+	}
+	s_buffer.set(NULL);
+	lock_guard<sys::Mutex> _(s_buffersLock);
+	b->exited = true;
+}
+
+void Trace::dumpChrome(std::ostream& os) {
+	std::vector<TraceBuffer*> buffers;
+	{
+		lock_guard<sys::Mutex> _(s_buffersLock);
+		buffers = s_buffers;
+		// the buffers of exited threads are written out one last time below
+		releaseExited();
+	}
+	// one trace process per pool, thread 0 for everything off-pool
+	std::map<const void*, int> pids;
+	pids[NULL] = 0;
+	char line[256];
+	bool first = true;
+	os << "{\"traceEvents\":[";
+	for (size_t i = 0; i < buffers.size(); i++) {
+		TraceBuffer* b = buffers[i];
+		if (pids.find(b->pool) == pids.end()) {
+			int pid = int(pids.size());
+			pids[b->pool] = pid;
+			snprintf(line, sizeof(line), "%s\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"pool %p\"}}",
+				first ? "" : ",", pid, b->pool);
+			os << line;
+			first = false;
+		}
+		if (b->worker >= 0) {
+			snprintf(line, sizeof(line), "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"worker %d\"}}",
+				first ? "" : ",", pids[b->pool], b->tid, b->worker);
+		} else {
+			snprintf(line, sizeof(line), "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%d,\"args\":{\"name\":\"thread %d\"}}",
+				first ? "" : ",", b->tid, b->tid);
+		}
+		os << line;
+		first = false;
+	}
+	for (size_t i = 0; i < buffers.size(); i++) {
+		TraceBuffer* b = buffers[i];
+		int pid = pids[b->pool];
+		uint64_t head = b->head.load(std::memory_order_acquire);
+		uint64_t start = head > NUMA_TRACE_BUFFER_EVENTS ? head - NUMA_TRACE_BUFFER_EVENTS : 0;
+		for (uint64_t j = start; j < head; j++) {
+			const TraceEvent& e = b->events[j & BUFFER_MASK];
+			double ts = (double(int64_t(e.tsc - s_base))) / s_ticksPerUs;
+			const char* phase;
+			const char* name;
+			switch (e.type) {
+			case RESUME:
+				phase = "B";
+				name = "task";
+				break;
+			case YIELD:
+			case BLOCK:
+			case END:
+				phase = "E";
+				name = "task";
+				break;
+			case INLINE:
+				// complete event, nests in the dispatcher's task slice
+				phase = "X";
+				name = "inline";
+				break;
+			default:
+				phase = "i";
+				name = eventName(e.type);
+				break;
+			}
+			char extra[64] = "";
+			if (phase[0] == 'i') {
+				snprintf(extra, sizeof(extra), ",\"s\":\"t\"");
+			} else if (phase[0] == 'X') {
+				snprintf(extra, sizeof(extra), ",\"dur\":%.3f", double(e.duration) / s_ticksPerUs);
+			}
+			snprintf(line, sizeof(line), ",\n{\"name\":\"%s\",\"ph\":\"%s\",\"ts\":%.3f,\"pid\":%d,\"tid\":%d%s,\"args\":{\"%s\":\"0x%llx\"}}",
+				name, phase, ts, pid, b->tid, extra,
+				phase[0] == 'E' ? eventName(e.type) : "arg", (unsigned long long)e.arg);
+			os << line;
+		}
+	}
+	os << "\n],\"displayTimeUnit\":\"ns\"}\n";
+}
+
+}
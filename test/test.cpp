@@ -1,5 +1,6 @@
 
 #include "NUMAExecutorGroup.h"
+#include "tests.h"
 #include <string>
 #include <vector>
 
@@ -21,10 +22,6 @@ void calc(void * ctx) {
 	cc->sem->up();
 }
 
-struct CalcTask {
-	Task::sys::Semaphore* succ;
-};
-
 template<class Ty>
 struct memblock {
 public:
@@ -43,7 +40,7 @@ private:
 	Ty * _ptr;
 };
 
-void calc_task(void* ctx) {
+void calc_task(Task::sys::Semaphore& succ) {
 	auto& taskPool = curExecutorGroup.get()->taskPool();
 	const int taskNum = 100;
 	memblock<CalcContext> ccs(taskNum);
@@ -58,18 +55,17 @@ void calc_task(void* ctx) {
 		taskPool.addTask(calc, cc);
 	}
 	sem.down(taskNum);
-	reinterpret_cast<CalcTask*>(ctx)->succ->up();
+	succ.up();
 }
 
+int g_failures = 0;
+
 void test_routine(void *ctx) {
 	NUMAExecutorGroup* eg(reinterpret_cast<NUMAExecutorGroup *>(ctx));
 	auto& taskPool = eg->taskPool();
-	auto& memPool = *eg->memPool();
 	Task::sys::Semaphore sem;
 	for(int i=1; i<=100; i++) {
-		CalcTask* ct = (CalcTask*)memPool.alloc(sizeof(CalcTask));
-		ct->succ = &sem;
-		taskPool.addTask(calc_task, ct);
+		taskPool.addTask([&sem] { calc_task(sem); });
 	}
 	for(int i=0; i<100; i++) {
 		sem.down();
@@ -84,5 +80,25 @@ int main() {
 	eg.Run(test_routine, &eg);
 
 	eg.Stop();
+
+	test_admission();
+	test_reactor();
+	test_channel();
+	test_future();
+	test_taskgraph();
+	test_trace();
+	test_pool();
+	test_blocking();
+	test_replicated();
+	test_partitioned();
+	test_sync();
+	test_cohortlock();
+	test_handoff();
+	test_parallel();
+	if (g_failures) {
+		std::cout << g_failures << " checks failed." << std::endl;
+		return 1;
+	}
+	std::cout << "all checks passed." << std::endl;
 	return 0;
 }
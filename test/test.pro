@@ -8,4 +8,19 @@ DEPENDPATH += .
 INCLUDEPATH += .
 
 # Input
-SOURCES += test.cpp
+HEADERS += tests.h
+SOURCES += test.cpp \
+           test_admission.cpp \
+           test_reactor.cpp \
+           test_channel.cpp \
+           test_future.cpp \
+           test_taskgraph.cpp \
+           test_trace.cpp \
+           test_pool.cpp \
+           test_blocking.cpp \
+           test_replicated.cpp \
+           test_partitioned.cpp \
+           test_sync.cpp \
+           test_cohortlock.cpp \
+           test_handoff.cpp \
+           test_parallel.cpp
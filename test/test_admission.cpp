@@ -0,0 +1,64 @@
+#include "parallel.h"
+#include "taskgraph.h"
+#include "tests.h"
+
+namespace {
+	std::atomic<int> g_nodes(0);
+
+	void countNode(void*) {
+		g_nodes++;
+	}
+}
+
+// A pool that refuses every submission past the first still finishes the
+// pieces, continuations and graph nodes of work it already took.
+void test_admission() {
+	NUMAExecutorGroup eg(0, 0x3);
+	Task::Pool& pool = eg.taskPool();
+	pool.setAdmission(1, Task::Pool::OVERLOAD_REJECT);
+
+	std::atomic<long> sum(0);
+	Task::parallel_for(pool, 0, 100000, [&sum](size_t lo, size_t hi) {
+		for (size_t i = lo; i < hi; i++) {
+			sum += long(i);
+		}
+	}, 64);
+	TEST_CHECK(sum.load() == 100000L * 99999 / 2);
+
+	long total = Task::parallel_reduce(pool, 0, 1000, 0L, [](size_t lo, size_t hi) {
+		return long(hi - lo);
+	}, [](long& acc, const long& part) {
+		acc += part;
+	}, 8);
+	TEST_CHECK(total == 1000);
+
+	Task::Promise<int> p;
+	Task::Future<int> doubled = p.getFuture().then([](int v) {
+		return v * 2;
+	});
+	p.setValue(21);
+	std::vector<Task::Future<int> > all(1, doubled);
+	Task::when_all(all).get();
+	TEST_CHECK(doubled.get() == 42);
+
+	Task::TaskGraph graph;
+	Task::TaskGraph::node_t prev = graph.addNode(countNode, NULL);
+	for (int i = 0; i < 15; i++) {
+		Task::TaskGraph::node_t n = graph.addNode(countNode, NULL);
+		graph.addEdge(prev, n);
+		prev = n;
+	}
+	TEST_CHECK(graph.run(pool));
+	TEST_CHECK(g_nodes.load() == 16);
+
+	// nothing was left behind, the last tasks may still be on their way out
+	while (pool.pending()) {
+		Task::sys::yieldThread();
+	}
+	// a new outside task is still held to the limit once the pool is busy
+	Task::sys::Semaphore release;
+	TEST_CHECK(pool.addTask([&release] { release.down(); }));
+	TEST_CHECK(!pool.addTask(countNode, NULL));
+	release.up();
+	pool.setAdmission(0);
+}
@@ -0,0 +1,43 @@
+#include "NUMAExecutorGroup.h"
+#include "tests.h"
+#include <stdexcept>
+
+// A blocking call offloaded from the only worker leaves it free for other
+// coroutines; results and exceptions come back to the caller.
+void test_blocking() {
+	NUMAExecutorGroup eg(0, 0x1);
+	Task::Pool& pool = eg.taskPool();
+	std::atomic<int> ticks(0);
+	std::atomic<bool> blocked(true);
+	int result = 0;
+	bool rethrown = false;
+	Task::sys::Semaphore done;
+	pool.addTask([&] {
+		result = Task::run_blocking([] {
+			Task::sys::Semaphore never;
+			never.timedDown(100);
+			return 42;
+		});
+		blocked = false;
+		try {
+			Task::run_blocking([] {
+				throw std::runtime_error("offloaded");
+			});
+		} catch (const std::runtime_error&) {
+			rethrown = true;
+		}
+		done.up();
+	});
+	pool.addTask([&] {
+		while (blocked) {
+			Task::io::sleep(5);
+			ticks++;
+		}
+		done.up();
+	});
+	done.down();
+	done.down();
+	TEST_CHECK(result == 42);
+	TEST_CHECK(rethrown);
+	TEST_CHECK(ticks.load() >= 5);
+}
@@ -0,0 +1,67 @@
+#include "channel.h"
+#include "tests.h"
+#include <vector>
+
+// sendBatch into a bounded channel smaller than the batch, a receiver on
+// the other end
+static void testSendBatch(Task::Pool& pool) {
+	Task::Channel<int> ch(8);
+	std::vector<int> items;
+	for (int i = 1; i <= 1000; i++) {
+		items.push_back(i);
+	}
+	std::atomic<long> sum(0);
+	Task::sys::Semaphore done;
+	pool.addTask([&] {
+		int v;
+		while (ch.recv(v)) {
+			sum += v;
+		}
+		done.up();
+	});
+	TEST_CHECK(ch.sendBatch(&items[0], items.size()) == items.size());
+	ch.close();
+	done.down();
+	TEST_CHECK(sum.load() == 1000L * 1001 / 2);
+}
+
+// A select over B and A is woken by a send on A but takes from B, which
+// was sent to right after. The receiver blocked on A must still get A's item.
+void test_channel() {
+	NUMAExecutorGroup eg(0, 0x1);
+	Task::Pool& pool = eg.taskPool();
+	Task::Channel<int> a, b;
+	Task::sys::Semaphore selected, received;
+	int selectedIndex = -1;
+	int value = 0;
+	pool.addTask([&] {
+		Task::ChannelBase* channels[] = { &b, &a };
+		selectedIndex = Task::select(channels, 2);
+		int v;
+		if (selectedIndex == 0) {
+			b.tryRecv(v);
+		}
+		selected.up();
+	});
+	pool.addTask([&] {
+		Task::io::sleep(10);
+		a.recv(value);
+		received.up();
+	});
+	// one worker: both sends land before the selector runs again
+	pool.addTask([&] {
+		Task::io::sleep(30);
+		a.send(1);
+		b.send(2);
+	});
+	TEST_CHECK(selected.timedDown(5000));
+	TEST_CHECK(selectedIndex == 0);
+	bool got = received.timedDown(1000);
+	TEST_CHECK(got);
+	TEST_CHECK(value == 1);
+	if (!got) {
+		a.close();
+		received.down();
+	}
+	testSendBatch(pool);
+}
@@ -0,0 +1,91 @@
+#include "cohortlock.h"
+#include "tests.h"
+#include <thread>
+#include <chrono>
+#include <vector>
+
+namespace {
+	void sleepMs(int ms) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+	}
+
+	// threads of two fake nodes increment a plain counter under the lock
+	void testExclusion() {
+		const int threads = 4, rounds = 20000;
+		Task::sys::CohortLock lock(2);
+		long counter = 0;
+		std::atomic<int> inside(0), overlaps(0);
+		std::vector<std::thread> workers;
+		for (int t = 0; t < threads; t++) {
+			workers.push_back(std::thread([&, t] {
+				Task::sys::CohortLock::setCurrentNode(t % 2);
+				for (int i = 0; i < rounds; i++) {
+					lock.lock();
+					if (++inside != 1) {
+						overlaps++;
+					}
+					counter++;
+					inside--;
+					lock.unlock();
+				}
+			}));
+		}
+		for (int t = 0; t < threads; t++) {
+			workers[t].join();
+		}
+		TEST_CHECK(counter == long(threads) * rounds);
+		TEST_CHECK(overlaps.load() == 0);
+	}
+
+	// Two threads of node 0 keep the lock busy while a thread of node 1
+	// waits on it. Node 0 passes the lock around at most MAX_PASSES times,
+	// then node 1 gets its turn long before node 0 runs out of work.
+	void testHandoff() {
+		const int rounds = 300;
+		Task::sys::CohortLock lock(2);
+		std::vector<int> order;
+		std::atomic<bool> go(false);
+		lock.lock();
+		std::thread other([&] {
+			Task::sys::CohortLock::setCurrentNode(1);
+			lock.lock();
+			order.push_back(1);
+			lock.unlock();
+		});
+		// node 1 is asleep on the global lock by now
+		sleepMs(50);
+		std::vector<std::thread> local;
+		for (int t = 0; t < 2; t++) {
+			local.push_back(std::thread([&] {
+				Task::sys::CohortLock::setCurrentNode(0);
+				while (!go.load()) {
+					std::this_thread::yield();
+				}
+				for (int i = 0; i < rounds; i++) {
+					lock.lock();
+					order.push_back(0);
+					// long enough for the other one to queue up behind us
+					std::this_thread::sleep_for(std::chrono::microseconds(200));
+					lock.unlock();
+				}
+			}));
+		}
+		go = true;
+		sleepMs(10);
+		lock.unlock();
+		other.join();
+		local[0].join();
+		local[1].join();
+		size_t turn = 0;
+		while (turn < order.size() && order[turn] != 1) {
+			turn++;
+		}
+		TEST_CHECK(order.size() == size_t(2 * rounds + 1));
+		TEST_CHECK(turn <= size_t(2 * (Task::sys::CohortLock::MAX_PASSES + 1)));
+	}
+}
+
+void test_cohortlock() {
+	testExclusion();
+	testHandoff();
+}
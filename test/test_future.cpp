@@ -0,0 +1,55 @@
+#include "future.h"
+#include "tests.h"
+#include <vector>
+
+// Continuations chained on a worker, a promise fulfilled from outside the
+// pool, when_all and when_any over several of them.
+void test_future() {
+	NUMAExecutorGroup eg(0, 0x3);
+	Task::Pool& pool = eg.taskPool();
+
+	std::vector<Task::Promise<int> > promises(4);
+	std::vector<Task::Future<int> > squares;
+	Task::sys::Semaphore chained;
+	pool.addTask([&] {
+		for (size_t i = 0; i < promises.size(); i++) {
+			squares.push_back(promises[i].getFuture().then([](int v) {
+				return v * v;
+			}));
+		}
+		chained.up();
+	});
+	chained.down();
+
+	Task::Future<size_t> first = Task::when_any(squares);
+	Task::Future<void> all = Task::when_all(squares);
+	promises[2].setValue(3);
+	TEST_CHECK(first.get() == 2);
+	TEST_CHECK(!all.ready());
+	for (size_t i = 0; i < promises.size(); i++) {
+		if (i != 2) {
+			promises[i].setValue(int(i));
+		}
+	}
+	all.get();
+	int sum = 0;
+	for (size_t i = 0; i < squares.size(); i++) {
+		sum += squares[i].get();
+	}
+	TEST_CHECK(sum == 0 + 1 + 9 + 9);
+
+	// a worker waiting on a future suspends instead of blocking the thread
+	Task::Promise<void> go;
+	Task::Future<int> waited = go.getFuture().then([] {
+		return 7;
+	});
+	Task::sys::Semaphore done;
+	int seen = 0;
+	pool.addTask([&] {
+		seen = waited.get();
+		done.up();
+	});
+	go.setValue();
+	done.down();
+	TEST_CHECK(seen == 7);
+}
@@ -0,0 +1,132 @@
+#include "handoff.h"
+#include "tests.h"
+
+namespace {
+	struct Target {
+		NUMAExecutorGroup* group;
+		std::atomic<int> ran;
+		std::atomic<int> misplaced;
+		std::atomic<long> sum;
+	};
+	Target g_target;
+
+	struct Payload {
+		int value;
+		char text[20];
+	};
+
+	void reset(NUMAExecutorGroup* group) {
+		g_target.group = group;
+		g_target.ran = 0;
+		g_target.misplaced = 0;
+		g_target.sum = 0;
+	}
+
+	void arrive(long value) {
+		if (curExecutorGroup.get() != g_target.group) {
+			g_target.misplaced++;
+		}
+		g_target.sum += value;
+		g_target.ran++;
+	}
+
+	void onPointer(void* ud) {
+		arrive(long(reinterpret_cast<intptr_t>(ud)));
+	}
+
+	void onPayload(void* ud) {
+		const Payload* p = static_cast<const Payload*>(ud);
+		if (strcmp(p->text, "payload") != 0) {
+			g_target.misplaced++;
+		}
+		arrive(p->value);
+	}
+
+	// keeps a task of the destination busy, so admission refuses the next
+	void onSlow(void* ud) {
+		Task::io::sleep(1);
+		onPointer(ud);
+	}
+
+	void waitFor(const std::atomic<int>& value, int expected, int ms) {
+		for (int i = 0; i < ms && value.load() != expected; i++) {
+			Task::io::sleep(1);
+		}
+	}
+
+	void sendPayload(Task::Handoff& link, int value) {
+		Payload p;
+		p.value = value;
+		strcpy(p.text, "payload");
+		link.send(onPayload, &p, sizeof(p));
+	}
+
+	// single, payload and batched entries sent from a task of the first
+	// group land on the second one, in a ring much smaller than the burst
+	void testDelivery(NUMAExecutorGroup& first, NUMAExecutorGroup& second) {
+		std::vector<NUMAExecutorGroup*> groups;
+		groups.push_back(&first);
+		groups.push_back(&second);
+		// rounded up to 8
+		Task::HandoffMesh mesh(groups, 5);
+		reset(&second);
+		const int singles = 100, payloads = 100, batched = 3 * Task::Handoff::BATCH + 5;
+		Task::sys::Semaphore sent;
+		first.taskPool().addTask([&] {
+			Task::Handoff& link = mesh.to(1);
+			TEST_CHECK(&link.destination() == &second);
+			for (int i = 1; i <= singles; i++) {
+				link.send(onPointer, reinterpret_cast<void*>(intptr_t(i)));
+			}
+			for (int i = 1; i <= payloads; i++) {
+				sendPayload(link, i);
+			}
+			Task::Handoff::Batch batch(link);
+			for (int i = 1; i <= batched; i++) {
+				batch.add(onPointer, reinterpret_cast<void*>(intptr_t(i)));
+			}
+			batch.flush();
+			sent.up();
+		});
+		sent.down();
+		const int total = singles + payloads + batched;
+		waitFor(g_target.ran, total, 5000);
+		TEST_CHECK(g_target.ran.load() == total);
+		TEST_CHECK(g_target.misplaced.load() == 0);
+		TEST_CHECK(g_target.sum.load() == long(singles) * (singles + 1) / 2 + long(payloads) * (payloads + 1) / 2 + long(batched) * (batched + 1) / 2);
+		TEST_CHECK(mesh.link(0, 1).pending() == 0);
+	}
+
+	// the destination refuses all but one task at a time; entries wait in
+	// the ring until it has room, and the link only goes once they are in
+	void testAdmission(NUMAExecutorGroup& first, NUMAExecutorGroup& second) {
+		reset(&second);
+		second.taskPool().setAdmission(1, Task::Pool::OVERLOAD_REJECT);
+		const int total = 50;
+		Task::Handoff* link = new Task::Handoff(second, 16);
+		Task::sys::Semaphore sent;
+		first.taskPool().addTask([&] {
+			for (int i = 1; i <= total; i++) {
+				link->send(onSlow, reinterpret_cast<void*>(intptr_t(i)));
+			}
+			sent.up();
+		});
+		sent.down();
+		delete link;
+		waitFor(g_target.ran, total, 5000);
+		TEST_CHECK(g_target.ran.load() == total);
+		TEST_CHECK(g_target.misplaced.load() == 0);
+		TEST_CHECK(g_target.sum.load() == long(total) * (total + 1) / 2);
+		// the limit did hold entries back
+		Task::PoolMetrics m;
+		second.metrics(m);
+		TEST_CHECK(m.total.tasksRejected > 0);
+		second.taskPool().setAdmission(0);
+	}
+}
+
+void test_handoff() {
+	NUMAExecutorGroup first(0, 0x1), second(0, 0x1);
+	testDelivery(first, second);
+	testAdmission(first, second);
+}
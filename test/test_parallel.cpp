@@ -0,0 +1,113 @@
+#include "parallel.h"
+#include "tests.h"
+
+namespace {
+	long value(size_t i) {
+		return long(i % 7) + 1;
+	}
+
+	// inclusive prefix sums of [lo, hi) against the serial loop, for sizes
+	// that do not split evenly into the 4 blocks per worker
+	void testScan(Task::Pool& pool) {
+		const size_t sizes[] = { 0, 1, 5, 13, 1000, 100003 };
+		for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+			const size_t lo = 3, hi = lo + sizes[s];
+			std::vector<long> expected(hi, 0), out(hi, 0);
+			long acc = 0;
+			for (size_t i = lo; i < hi; i++) {
+				acc += value(i);
+				expected[i] = acc;
+			}
+			long total = Task::parallel_scan(pool, lo, hi, 0L, [](size_t b, size_t e) {
+				long part = 0;
+				for (size_t i = b; i < e; i++) {
+					part += value(i);
+				}
+				return part;
+			}, [&out](size_t b, size_t e, long prefix) {
+				for (size_t i = b; i < e; i++) {
+					prefix += value(i);
+					out[i] = prefix;
+				}
+			}, [](long& a, long part) {
+				a += part;
+			});
+			TEST_CHECK(total == acc);
+			TEST_CHECK(out == expected);
+		}
+	}
+
+	// every index is visited once when the range is not a multiple of the grain
+	void testFor(Task::Pool& pool) {
+		const size_t size = 10007, grain = 64;
+		std::vector<std::atomic<int> > hits(size);
+		for (size_t i = 0; i < size; i++) {
+			hits[i] = 0;
+		}
+		Task::parallel_for(pool, 0, size, [&hits](size_t lo, size_t hi) {
+			for (size_t i = lo; i < hi; i++) {
+				hits[i]++;
+			}
+		}, grain);
+		int wrong = 0;
+		for (size_t i = 0; i < size; i++) {
+			if (hits[i].load() != 1) {
+				wrong++;
+			}
+		}
+		TEST_CHECK(wrong == 0);
+	}
+
+	// Each slice of the partition only runs on its own group, and the
+	// partials of both groups add up to the serial sum.
+	void testPartitioned(NUMAExecutorGroup& first, NUMAExecutorGroup& second) {
+		std::vector<NUMAExecutorGroup*> groups;
+		groups.push_back(&first);
+		groups.push_back(&second);
+		const size_t size = 100003;
+		std::vector<size_t> bounds = Task::partition(groups, 0, size);
+		TEST_CHECK(bounds.size() == 3 && bounds[0] == 0 && bounds[2] == size);
+		std::atomic<int> misplaced(0);
+		long sum = Task::parallel_reduce(groups, bounds, 0L, [&](size_t lo, size_t hi) {
+			NUMAExecutorGroup* owner = lo < bounds[1] ? &first : &second;
+			if (curExecutorGroup.get() != owner || (lo < bounds[1]) != (hi <= bounds[1])) {
+				misplaced++;
+			}
+			long part = 0;
+			for (size_t i = lo; i < hi; i++) {
+				part += long(i);
+			}
+			return part;
+		}, [](long& acc, long part) {
+			acc += part;
+		}, 1000);
+		TEST_CHECK(sum == long(size) * long(size - 1) / 2);
+		TEST_CHECK(misplaced.load() == 0);
+
+		// same from a task of the first group, whose slice then runs inline
+		std::atomic<size_t> visited(0);
+		Task::sys::Semaphore done;
+		first.taskPool().addTask([&] {
+			Task::parallel_for(groups, bounds, [&](size_t lo, size_t hi) {
+				NUMAExecutorGroup* owner = lo < bounds[1] ? &first : &second;
+				if (curExecutorGroup.get() != owner) {
+					misplaced++;
+				}
+				visited += hi - lo;
+			}, 1000);
+			done.up();
+		});
+		done.down();
+		TEST_CHECK(visited.load() == size);
+		TEST_CHECK(misplaced.load() == 0);
+	}
+}
+
+void test_parallel() {
+	// 8 blocks for the scan
+	Task::Pool pool(2, 0x3);
+	testScan(pool);
+	testFor(pool);
+	NUMAExecutorGroup first(0, 0x1), second(0, 0x1);
+	testPartitioned(first, second);
+}
@@ -0,0 +1,49 @@
+#include "partitioned.h"
+#include "tests.h"
+
+namespace {
+	void testLayout(const std::vector<NUMAExecutorGroup*>& groups, Task::PartitionedArray<long>::layout_t layout) {
+		// a few chunks per group plus a partial one at the end
+		const size_t size = 100003;
+		Task::PartitionedArray<long> array(groups, size, layout);
+		TEST_CHECK(array.size() == size);
+		TEST_CHECK(size > array.chunkSize() * 3);
+
+		// every range runs on the group that owns it
+		std::atomic<int> misplaced(0);
+		std::atomic<size_t> visited(0);
+		array.forEach([&](size_t lo, size_t hi) {
+			for (size_t i = lo; i < hi; i++) {
+				if (curExecutorGroup.get() != groups[array.owner(i)]) {
+					misplaced++;
+				}
+				array[i] = long(i);
+			}
+			visited += hi - lo;
+		});
+		TEST_CHECK(misplaced.load() == 0);
+		TEST_CHECK(visited.load() == size);
+
+		long sum = array.reduce(0L, [&array](size_t lo, size_t hi) {
+			long part = 0;
+			for (size_t i = lo; i < hi; i++) {
+				part += array[i];
+			}
+			return part;
+		}, [](long& acc, long part) {
+			acc += part;
+		});
+		TEST_CHECK(sum == long(size) * long(size - 1) / 2);
+	}
+}
+
+// The reduce of 0..n-1 over both layouts adds up to n(n-1)/2, and forEach
+// hands each range to the group owning its chunk.
+void test_partitioned() {
+	NUMAExecutorGroup first(0, 0x1), second(0, 0x1);
+	std::vector<NUMAExecutorGroup*> groups;
+	groups.push_back(&first);
+	groups.push_back(&second);
+	testLayout(groups, Task::PartitionedArray<long>::BLOCK);
+	testLayout(groups, Task::PartitionedArray<long>::CYCLIC);
+}
@@ -0,0 +1,230 @@
+#include "NUMAExecutorGroup.h"
+#include "tests.h"
+#include <thread>
+
+namespace {
+	void spin(int us) {
+		unsigned long long until = Task::Trace::timestamp() + (unsigned long long)(us * Task::Trace::ticksPerUs());
+		while (Task::Trace::timestamp() < until) {
+		}
+	}
+
+	void waitFor(const std::atomic<int>& value, int expected, int ms) {
+		for (int i = 0; i < ms && value.load() != expected; i++) {
+			Task::io::sleep(1);
+		}
+	}
+
+	// idle workers retire down to the minimum, a backlog brings them back
+	void testElastic() {
+		// the workers are pinned to CPUs 0-2
+		if (std::thread::hardware_concurrency() < 3) {
+			return;
+		}
+		Task::Pool pool(3, 0x7);
+		pool.setElastic(1, 4, 1, 50);
+		for (int i = 0; i < 2000 && pool.activeThreads() > 1; i++) {
+			Task::io::sleep(1);
+		}
+		TEST_CHECK(pool.activeThreads() == 1);
+		std::atomic<int> done(0);
+		const int tasks = 400;
+		for (int i = 0; i < tasks; i++) {
+			pool.addTask([&done] {
+				spin(500);
+				done++;
+			});
+			if (i % 40 == 0) {
+				Task::io::sleep(2);
+			}
+		}
+		TEST_CHECK(pool.activeThreads() > 1);
+		waitFor(done, tasks, 10000);
+		TEST_CHECK(done.load() == tasks);
+	}
+
+	// drain() lets running and queued tasks finish, their subtasks
+	// included, and refuses new work from outside
+	void testDrain() {
+		Task::Pool pool(2, 0x3);
+		std::atomic<int> done(0);
+		for (int i = 0; i < 10; i++) {
+			pool.addTask([&pool, &done] {
+				Task::io::sleep(20);
+				pool.addTask([&done] {
+					done++;
+				});
+				done++;
+			});
+		}
+		TEST_CHECK(pool.drain(10000));
+		TEST_CHECK(done.load() == 20);
+		TEST_CHECK(pool.pending() == 0);
+		TEST_CHECK(!pool.addTask([&done] {
+			done++;
+		}));
+	}
+
+	struct Counted {
+		std::atomic<int>& live;
+		explicit Counted(std::atomic<int>& l) : live(l) {
+			live++;
+		}
+		Counted(const Counted& rhs) : live(rhs.live) {
+			live++;
+		}
+		~Counted() {
+			live--;
+		}
+	};
+
+	// closures too big for the coroutine spill to the group's memPool and
+	// are destroyed like the small ones when their task returns
+	void testClosures() {
+		NUMAExecutorGroup eg(0, 0x1);
+		std::atomic<int> live(0), sum(0), done(0);
+		{
+			Counted small(live);
+			eg.taskPool().addTask([small, &sum, &done] {
+				sum += 1;
+				done++;
+			});
+			char big[4 * coroutine::CLOSURE_SIZE];
+			for (size_t i = 0; i < sizeof(big); i++) {
+				big[i] = char(i);
+			}
+			Counted counted(live);
+			eg.taskPool().addTask([big, counted, &sum, &done] {
+				int s = 0;
+				for (size_t i = 0; i < sizeof(big); i++) {
+					s += big[i] == char(i);
+				}
+				sum += s;
+				done++;
+			});
+		}
+		waitFor(done, 2, 5000);
+		// the closures are destroyed after they bump done
+		waitFor(live, 0, 1000);
+		TEST_CHECK(sum.load() == 1 + 4 * int(coroutine::CLOSURE_SIZE));
+		TEST_CHECK(live.load() == 0);
+	}
+
+	// created and not freed: cached, running or a worker's dispatch loop
+	uint64_t coroutinesHeld(const Task::Pool& pool) {
+		Task::PoolMetrics m;
+		pool.metrics(m);
+		return m.total.coroutinesCreated - m.total.coroutinesFreed;
+	}
+
+	// a burst leaves at most the worker's cache and the shared list filled,
+	// an idle interval frees the worker's share
+	void testCoroutineCache() {
+		const size_t cap = 4;
+		Task::Pool pool(1, 0x1);
+		pool.setCoroutineCache(cap);
+		Task::io::sleep(20);
+		// the workers' own dispatch loops
+		uint64_t base = coroutinesHeld(pool);
+		std::atomic<int> done(0);
+		const int tasks = 40;
+		for (int i = 0; i < tasks; i++) {
+			pool.addTask([&done] {
+				Task::io::sleep(20);
+				done++;
+			});
+		}
+		waitFor(done, tasks, 5000);
+		TEST_CHECK(done.load() == tasks);
+		for (int i = 0; i < 1000 && pool.pending(); i++) {
+			Task::io::sleep(1);
+		}
+		Task::PoolMetrics m;
+		pool.metrics(m);
+		TEST_CHECK(m.total.coroutinesCreated > 2 * cap);
+		TEST_CHECK(coroutinesHeld(pool) - base <= 2 * cap);
+		for (int i = 0; i < 5000 && coroutinesHeld(pool) - base > cap; i++) {
+			Task::io::sleep(1);
+		}
+		TEST_CHECK(coroutinesHeld(pool) - base == cap);
+	}
+
+	// busy-polling workers never park: work submitted from outside, and
+	// timers set by tasks, are picked up while spinning
+	void testBusyPoll() {
+		Task::Pool pool(1, 0x1);
+		pool.setBusyPoll(true);
+		Task::io::sleep(20);
+		Task::PoolMetrics before;
+		pool.metrics(before);
+		std::atomic<int> done(0);
+		const int tasks = 20;
+		for (int i = 0; i < tasks; i++) {
+			pool.addTask([&done] {
+				Task::io::sleep(1);
+				done++;
+			});
+			waitFor(done, i + 1, 1000);
+		}
+		TEST_CHECK(done.load() == tasks);
+		Task::PoolMetrics after;
+		pool.metrics(after);
+		TEST_CHECK(after.total.parks == before.total.parks);
+		pool.setBusyPoll(false);
+	}
+
+	void busyTask(void* ud) {
+		std::atomic<int>* done = static_cast<std::atomic<int>*>(ud);
+		spin(200);
+		(*done)++;
+	}
+
+	// The per-worker counters add up to the total, and with per-task
+	// attribution on from the start so do the per-function ones. Where
+	// perf_event_open is denied every reading stays zero.
+	void testPerfCounters() {
+		Task::Pool pool(2, 0x3);
+		pool.setPerfCounters(true, true);
+		std::atomic<int> done(0);
+		const int tasks = 40;
+		for (int i = 0; i < tasks; i++) {
+			pool.addTask(busyTask, &done, i % 2);
+		}
+		waitFor(done, tasks, 5000);
+		TEST_CHECK(done.load() == tasks);
+		Task::PerfSnapshot snap;
+		pool.perfSnapshot(snap);
+		pool.setPerfCounters(false);
+		TEST_CHECK(snap.workers.size() == 2);
+		for (int c = 0; c < Task::PerfCounters::COUNTER_COUNT; c++) {
+			uint64_t workers = 0, functions = 0;
+			for (size_t w = 0; w < snap.workers.size(); w++) {
+				workers += snap.workers[w].values[c];
+			}
+			for (std::map<coroutine_func_t, Task::PerfCounters::Sample>::const_iterator t = snap.tasks.begin(); t != snap.tasks.end(); ++t) {
+				functions += t->second.values[c];
+			}
+			TEST_CHECK(workers == snap.total.values[c]);
+			TEST_CHECK(functions == snap.total.values[c]);
+			if (!snap.available) {
+				TEST_CHECK(snap.total.values[c] == 0);
+			}
+		}
+		if (snap.available) {
+			TEST_CHECK(snap.total.values[Task::PerfCounters::CYCLES] > 0);
+			TEST_CHECK(snap.total.values[Task::PerfCounters::INSTRUCTIONS] > 0);
+			TEST_CHECK(snap.tasks.count(busyTask) == 1);
+		} else {
+			TEST_CHECK(snap.tasks.empty());
+		}
+	}
+}
+
+void test_pool() {
+	testClosures();
+	testCoroutineCache();
+	testDrain();
+	testElastic();
+	testBusyPoll();
+	testPerfCounters();
+}
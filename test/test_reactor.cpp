@@ -0,0 +1,140 @@
+#include "NUMAExecutorGroup.h"
+#include "tests.h"
+#include <cstring>
+#include <cstdlib>
+#ifndef _WIN32
+#include <unistd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+namespace {
+	struct IoResults {
+		Task::Reactor::backend_t backend;
+		bool pipe;
+		bool socketPair;
+		bool loopback;
+		bool file;
+		int ticks;
+	};
+
+	bool roundTrip(Task::Pool& pool, int rd, int wr) {
+		char out[] = "ping";
+		char in[sizeof(out)] = { 0 };
+		std::atomic<bool> got(false);
+		Task::Semaphore done;
+		// the reader waits first, the writer gets it going
+		pool.addTask([&] {
+			got = Task::io::read(rd, in, sizeof(in)) == sizeof(in);
+			done.up();
+		});
+		Task::io::sleep(10);
+		Task::io::write(wr, out, sizeof(out));
+		done.down(1);
+		return got && strcmp(in, out) == 0;
+	}
+
+	void runIo(Task::Pool& pool, IoResults& r) {
+		r.backend = Task::curReactor.get()->backend();
+		// timers keep firing while coroutines wait on I/O
+		pool.addTask([&r] {
+			for (int i = 0; i < 5; i++) {
+				Task::io::sleep(2);
+				r.ticks++;
+			}
+		});
+
+		int p[2];
+		r.pipe = pipe(p) == 0 && roundTrip(pool, p[0], p[1]);
+		close(p[0]);
+		close(p[1]);
+
+		int sv[2];
+		r.socketPair = socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0 && roundTrip(pool, sv[0], sv[1]) && roundTrip(pool, sv[1], sv[0]);
+		close(sv[0]);
+		close(sv[1]);
+
+		r.loopback = false;
+		int listener = socket(AF_INET, SOCK_STREAM, 0);
+		sockaddr_in addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		socklen_t len = sizeof(addr);
+		if (bind(listener, (sockaddr*)&addr, sizeof(addr)) == 0 && listen(listener, 4) == 0
+			&& getsockname(listener, (sockaddr*)&addr, &len) == 0) {
+			std::atomic<int> accepted(-1);
+			Task::Semaphore done;
+			pool.addTask([&] {
+				accepted = Task::io::accept(listener);
+				done.up();
+			});
+			Task::io::sleep(10);
+			int client = socket(AF_INET, SOCK_STREAM, 0);
+			bool connected = connect(client, (sockaddr*)&addr, sizeof(addr)) == 0;
+			done.down(1);
+			r.loopback = connected && accepted >= 0 && roundTrip(pool, accepted, client) && roundTrip(pool, client, accepted);
+			close(client);
+			if (accepted >= 0) {
+				close(accepted);
+			}
+		}
+		close(listener);
+
+		char path[] = "/tmp/numa-test-XXXXXX";
+		int fd = mkstemp(path);
+		r.file = false;
+		if (fd >= 0) {
+			unlink(path);
+			char out[] = "node-local";
+			char in[sizeof(out)] = { 0 };
+			r.file = Task::io::write(fd, out, sizeof(out), 4096) == sizeof(out)
+				&& Task::io::read(fd, in, sizeof(in), 4096) == sizeof(in)
+				&& strcmp(in, out) == 0;
+			close(fd);
+		}
+		while (r.ticks < 5) {
+			Task::io::sleep(1);
+		}
+	}
+
+	void checkBackend(bool uring) {
+		if (uring) {
+			unsetenv("NUMA_NO_IO_URING");
+		} else {
+			setenv("NUMA_NO_IO_URING", "1", 1);
+		}
+		IoResults r;
+		memset(&r, 0, sizeof(r));
+		{
+			NUMAExecutorGroup eg(0, 0x1);
+			Task::Pool& pool = eg.taskPool();
+			Task::sys::Semaphore done;
+			pool.addTask([&] {
+				runIo(pool, r);
+				done.up();
+			});
+			done.down();
+		}
+		unsetenv("NUMA_NO_IO_URING");
+		// kernels without io_uring only have the fallback to test
+		if (!uring) {
+			TEST_CHECK(r.backend == Task::Reactor::EPOLL);
+		}
+		TEST_CHECK(r.pipe);
+		TEST_CHECK(r.socketPair);
+		TEST_CHECK(r.loopback);
+		TEST_CHECK(r.file);
+		TEST_CHECK(r.ticks == 5);
+	}
+}
+
+// pipes, sockets and files through the worker's Reactor, on io_uring and
+// on the epoll fallback
+void test_reactor() {
+	checkBackend(true);
+	checkBackend(false);
+}
+#else
+void test_reactor() {
+}
+#endif
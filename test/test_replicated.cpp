@@ -0,0 +1,63 @@
+#include "replicated.h"
+#include "tests.h"
+
+namespace {
+	// written as a whole, a reader seeing a != b saw a torn copy
+	struct Pair {
+		long a;
+		long b;
+		Pair() : a(0), b(0) {}
+	};
+}
+
+// Every group reads what the last update() published, and readers running
+// alongside updates only ever see whole values.
+void test_replicated() {
+	NUMAExecutorGroup first(0, 0x1), second(0, 0x1);
+	NUMAExecutorGroup* groups[] = { &first, &second };
+	Task::NodeReplicated<Pair> value(groups, 2);
+
+	std::atomic<bool> stop(false);
+	std::atomic<int> torn(0), readers(0);
+	Task::sys::Semaphore done;
+	for (int g = 0; g < 2; g++) {
+		groups[g]->taskPool().addTask([&] {
+			readers++;
+			while (!stop) {
+				value.read([&torn](const Pair& p) {
+					if (p.a != p.b) {
+						torn++;
+					}
+					return 0;
+				});
+				Task::Pool::getRunningTask()->yield();
+			}
+			done.up();
+		});
+	}
+	for (long i = 1; i <= 200; i++) {
+		value.update([i](Pair& p) {
+			p.a = i;
+			p.b = i;
+		});
+	}
+	stop = true;
+	done.down();
+	done.down();
+	TEST_CHECK(readers.load() == 2);
+	TEST_CHECK(torn.load() == 0);
+
+	std::atomic<long> seen[2];
+	for (int g = 0; g < 2; g++) {
+		seen[g] = -1;
+		groups[g]->taskPool().addTask([&, g] {
+			seen[g] = value.get().a;
+			done.up();
+		});
+	}
+	done.down();
+	done.down();
+	TEST_CHECK(seen[0].load() == 200);
+	TEST_CHECK(seen[1].load() == 200);
+	TEST_CHECK(value.get().b == 200);
+}
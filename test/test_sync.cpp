@@ -0,0 +1,287 @@
+#include "NUMAExecutorGroup.h"
+#include "tests.h"
+
+namespace {
+	void waitFor(const std::atomic<int>& value, int expected, int ms) {
+		for (int i = 0; i < ms && value.load() != expected; i++) {
+			Task::io::sleep(1);
+		}
+	}
+
+	// Coroutines that yield inside the critical section, so the others
+	// find the lock taken and park on it.
+	void testMutex(Task::Pool& pool) {
+		const int tasks = 8, rounds = 200;
+		Task::Mutex m;
+		long counter = 0;
+		std::atomic<int> inside(0), overlaps(0);
+		Task::sys::Semaphore done;
+		for (int t = 0; t < tasks; t++) {
+			pool.addTask([&] {
+				for (int i = 0; i < rounds; i++) {
+					m.lock();
+					if (++inside != 1) {
+						overlaps++;
+					}
+					long v = counter;
+					if (i % 8 == 0) {
+						Task::Pool::getRunningTask()->yield();
+					}
+					counter = v + 1;
+					inside--;
+					m.unlock();
+				}
+				done.up();
+			});
+		}
+		for (int t = 0; t < tasks; t++) {
+			done.down();
+		}
+		TEST_CHECK(counter == long(tasks) * rounds);
+		TEST_CHECK(overlaps.load() == 0);
+		TEST_CHECK(m.tryLock());
+		m.unlock();
+	}
+
+	// Readers hold the lock together until all of them are in; writers
+	// then alternate with readers and always find the lock to themselves.
+	void testSharedMutex(Task::Pool& pool) {
+		const int readers = 4, writers = 2, rounds = 50;
+		Task::SharedMutex m;
+		std::atomic<int> reading(0), writing(0), maxReading(0), violations(0);
+		Task::sys::Semaphore done;
+		for (int r = 0; r < readers; r++) {
+			pool.addTask([&] {
+				m.lockShared();
+				reading++;
+				for (int i = 0; i < 1000 && reading.load() < readers; i++) {
+					Task::io::sleep(1);
+				}
+				int n = reading.load();
+				if (n > maxReading.load()) {
+					maxReading = n;
+				}
+				reading--;
+				m.unlockShared();
+				done.up();
+			});
+		}
+		for (int r = 0; r < readers; r++) {
+			done.down();
+		}
+		TEST_CHECK(maxReading.load() == readers);
+
+		for (int t = 0; t < readers + writers; t++) {
+			bool writer = t < writers;
+			pool.addTask([&, writer] {
+				for (int i = 0; i < rounds; i++) {
+					if (writer) {
+						m.lock();
+						if (++writing != 1 || reading.load()) {
+							violations++;
+						}
+						Task::Pool::getRunningTask()->yield();
+						writing--;
+						m.unlock();
+					} else {
+						m.lockShared();
+						reading++;
+						if (writing.load()) {
+							violations++;
+						}
+						Task::Pool::getRunningTask()->yield();
+						reading--;
+						m.unlockShared();
+					}
+				}
+				done.up();
+			});
+		}
+		for (int t = 0; t < readers + writers; t++) {
+			done.down();
+		}
+		TEST_CHECK(violations.load() == 0);
+		TEST_CHECK(m.tryLock());
+		m.unlock();
+	}
+
+	// Waiters each take one ticket. notifyOne lets one of them through,
+	// notifyAll the rest, and every wait returns with the mutex held.
+	void testConditionVariable(Task::Pool& pool) {
+		const int waiters = 3;
+		Task::Mutex m;
+		Task::ConditionVariable cv;
+		int tickets = 0;
+		std::atomic<int> waiting(0), woken(0), unlocked(0);
+		Task::sys::Semaphore done;
+		for (int w = 0; w < waiters; w++) {
+			pool.addTask([&] {
+				m.lock();
+				waiting++;
+				cv.wait(m, [&tickets] {
+					return tickets > 0;
+				});
+				if (m.tryLock()) {
+					unlocked++;
+					m.unlock();
+				}
+				tickets--;
+				woken++;
+				m.unlock();
+				done.up();
+			});
+		}
+		pool.addTask([&] {
+			while (waiting.load() < waiters) {
+				Task::io::sleep(1);
+			}
+			m.lock();
+			tickets = 1;
+			cv.notifyOne();
+			m.unlock();
+			for (int i = 0; i < 1000 && woken.load() < 1; i++) {
+				Task::io::sleep(1);
+			}
+			// the others stay parked until notified again
+			Task::io::sleep(20);
+			TEST_CHECK(woken.load() == 1);
+			m.lock();
+			tickets = waiters - 1;
+			cv.notifyAll();
+			m.unlock();
+		});
+		for (int w = 0; w < waiters; w++) {
+			done.down();
+		}
+		TEST_CHECK(woken.load() == waiters);
+		TEST_CHECK(unlocked.load() == 0);
+		TEST_CHECK(tickets == 0);
+	}
+	// up(n) with more waiters than n wakes exactly n of them, the rest
+	// stay parked until the count covers them too
+	void testSemaphore(Task::Pool& pool) {
+		const int waiters = 5;
+		Task::Semaphore sem(0);
+		std::atomic<int> waiting(0), woken(0);
+		Task::sys::Semaphore done;
+		for (int w = 0; w < waiters; w++) {
+			pool.addTask([&] {
+				waiting++;
+				sem.down(1);
+				woken++;
+				done.up();
+			});
+		}
+		waitFor(waiting, waiters, 1000);
+		Task::io::sleep(20);
+		sem.up(3);
+		waitFor(woken, 3, 1000);
+		Task::io::sleep(20);
+		TEST_CHECK(woken.load() == 3);
+		sem.up(2);
+		for (int w = 0; w < waiters; w++) {
+			done.down();
+		}
+		TEST_CHECK(woken.load() == waiters);
+		// nothing left over: a later down only passes after another up
+		std::atomic<int> passed(0);
+		pool.addTask([&] {
+			sem.down(1);
+			passed++;
+			done.up();
+		});
+		Task::io::sleep(20);
+		TEST_CHECK(passed.load() == 0);
+		sem.up(1);
+		done.down();
+		TEST_CHECK(passed.load() == 1);
+	}
+
+	// One Barrier for several generations. Nobody leaves a generation
+	// before all of its parties arrived, and nobody from the next one
+	// slips into it.
+	void testBarrier(Task::Pool& pool) {
+		const int parties = 4, generations = 5;
+		Task::Barrier barrier(parties);
+		std::atomic<int> arrived[generations];
+		for (int g = 0; g < generations; g++) {
+			arrived[g] = 0;
+		}
+		std::atomic<int> early(0);
+		Task::sys::Semaphore done;
+		for (int p = 0; p < parties; p++) {
+			// spread over both workers
+			pool.addTask([&] {
+				for (int g = 0; g < generations; g++) {
+					arrived[g]++;
+					barrier.sync();
+					if (arrived[g].load() != parties || (g + 1 < generations && arrived[g + 1].load() == parties)) {
+						early++;
+					}
+				}
+				done.up();
+			}, p % 2);
+		}
+		for (int p = 0; p < parties; p++) {
+			TEST_CHECK(done.timedDown(5000));
+		}
+		TEST_CHECK(early.load() == 0);
+	}
+
+	// signal() hands itself to one parked waiter. With nobody waiting it
+	// stays set until a wait() takes it, which resets it.
+	void testEvent(Task::Pool& pool) {
+		const int waiters = 3;
+		Task::Event event;
+		std::atomic<int> waiting(0), woken(0);
+		Task::sys::Semaphore done;
+		for (int w = 0; w < waiters; w++) {
+			pool.addTask([&] {
+				waiting++;
+				event.wait();
+				woken++;
+				done.up();
+			});
+		}
+		waitFor(waiting, waiters, 1000);
+		Task::io::sleep(20);
+		TEST_CHECK(woken.load() == 0);
+		event.signal();
+		waitFor(woken, 1, 1000);
+		Task::io::sleep(20);
+		TEST_CHECK(woken.load() == 1);
+		event.signal();
+		event.signal();
+		for (int w = 0; w < waiters; w++) {
+			done.down();
+		}
+		TEST_CHECK(woken.load() == waiters);
+
+		event.signal();
+		std::atomic<int> passed(0);
+		pool.addTask([&] {
+			// the first wait takes the set event, the second one parks
+			event.wait();
+			passed++;
+			event.wait();
+			passed++;
+			done.up();
+		});
+		waitFor(passed, 1, 1000);
+		Task::io::sleep(20);
+		TEST_CHECK(passed.load() == 1);
+		event.signal();
+		done.down();
+		TEST_CHECK(passed.load() == 2);
+	}
+}
+
+void test_sync() {
+	NUMAExecutorGroup eg(0, 0x3);
+	testMutex(eg.taskPool());
+	testSharedMutex(eg.taskPool());
+	testConditionVariable(eg.taskPool());
+	testSemaphore(eg.taskPool());
+	testBarrier(eg.taskPool());
+	testEvent(eg.taskPool());
+}
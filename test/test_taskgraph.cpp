@@ -0,0 +1,58 @@
+#include "taskgraph.h"
+#include "tests.h"
+
+namespace {
+	// order in which the diamond's nodes finished
+	struct Diamond {
+		std::atomic<int> clock;
+		int finished[4];
+	};
+	struct Step {
+		Diamond* run;
+		int node;
+	};
+
+	void s_step(void* ud) {
+		Step* s = reinterpret_cast<Step*>(ud);
+		if (s->node == 1) {
+			// the slow branch, the join must still wait for it
+			Task::io::sleep(5);
+		}
+		s->run->finished[s->node] = ++s->run->clock;
+	}
+}
+
+// top -> left, right -> bottom, run twice; a cycle is refused
+void test_taskgraph() {
+	NUMAExecutorGroup eg(0, 0x3);
+	Diamond run;
+	Step steps[4];
+	Task::TaskGraph graph;
+	Task::TaskGraph::node_t nodes[4];
+	for (int i = 0; i < 4; i++) {
+		steps[i].run = &run;
+		steps[i].node = i;
+		nodes[i] = graph.addNode(s_step, &steps[i]);
+	}
+	graph.addEdge(nodes[0], nodes[1]);
+	graph.addEdge(nodes[0], nodes[2]);
+	graph.addEdge(nodes[1], nodes[3]);
+	graph.addEdge(nodes[2], nodes[3]);
+	for (int pass = 0; pass < 2; pass++) {
+		run.clock = 0;
+		for (int i = 0; i < 4; i++) {
+			run.finished[i] = 0;
+		}
+		TEST_CHECK(graph.run(eg.taskPool()));
+		TEST_CHECK(run.finished[0] == 1);
+		TEST_CHECK(run.finished[1] > 1 && run.finished[2] > 1);
+		TEST_CHECK(run.finished[3] == 4);
+	}
+
+	Task::TaskGraph cyclic;
+	Task::TaskGraph::node_t a = cyclic.addNode(s_step, &steps[0]);
+	Task::TaskGraph::node_t b = cyclic.addNode(s_step, &steps[2]);
+	cyclic.addEdge(a, b);
+	cyclic.addEdge(b, a);
+	TEST_CHECK(!cyclic.run(eg.taskPool()));
+}
@@ -0,0 +1,64 @@
+#include "taskpool.h"
+#include "tests.h"
+#include <sstream>
+#include <string>
+
+namespace {
+	size_t occurrences(const std::string& s, const std::string& what) {
+		size_t n = 0;
+		for (size_t pos = s.find(what); pos != std::string::npos; pos = s.find(what, pos + 1)) {
+			n++;
+		}
+		return n;
+	}
+}
+
+// What the scheduler hooks record, dumped as Chrome trace JSON. The hooks
+// themselves are only compiled in with NUMA_TRACE, the recorder always is.
+void test_trace() {
+	Task::Trace::reset();
+	Task::Trace::enable(true);
+	Task::Trace::record(Task::Trace::RESUME, 1);
+	uint64_t start = Task::Trace::timestamp();
+	Task::Trace::recordSpan(Task::Trace::INLINE, 2, start);
+	Task::Trace::record(Task::Trace::YIELD, 1);
+	Task::Trace::record(Task::Trace::RESUME, 1);
+	Task::Trace::record(Task::Trace::STEAL, 3);
+	Task::Trace::record(Task::Trace::END, 1);
+	Task::Trace::enable(false);
+
+	std::ostringstream out;
+	Task::Trace::dumpChrome(out);
+	std::string json = out.str();
+	TEST_CHECK(json.find("{\"traceEvents\":[") == 0);
+	TEST_CHECK(occurrences(json, "\"ph\":\"B\"") == 2);
+	TEST_CHECK(occurrences(json, "\"ph\":\"E\"") == 2);
+	TEST_CHECK(occurrences(json, "\"ph\":\"X\"") == 1);
+	TEST_CHECK(occurrences(json, "\"dur\":") == 1);
+	TEST_CHECK(occurrences(json, "\"name\":\"steal\"") == 1);
+
+	Task::Trace::reset();
+	std::ostringstream empty;
+	Task::Trace::dumpChrome(empty);
+	TEST_CHECK(occurrences(empty.str(), "\"ph\":\"B\"") == 0);
+
+	// a worker's buffer outlives the worker until the next dump
+	Task::Trace::enable(true);
+	{
+		Task::Pool pool(1, 0x1);
+		Task::sys::Semaphore done;
+		pool.addTask([&done] {
+			Task::Trace::record(Task::Trace::STEAL, 0xfeed);
+			done.up();
+		});
+		done.down();
+	}
+	Task::Trace::enable(false);
+	std::ostringstream exited;
+	Task::Trace::dumpChrome(exited);
+	TEST_CHECK(occurrences(exited.str(), "\"0xfeed\"") == 1);
+	std::ostringstream released;
+	Task::Trace::dumpChrome(released);
+	TEST_CHECK(occurrences(released.str(), "\"0xfeed\"") == 0);
+	Task::Trace::reset();
+}
@@ -0,0 +1,32 @@
+#ifndef _NUMA_TESTS_H_
+#define _NUMA_TESTS_H_
+#include <iostream>
+
+// Behaviour checks main() runs after the demo job. A failed check is
+// reported and counted, the run goes on with the next one.
+extern int g_failures;
+
+#define TEST_CHECK(cond) \
+	do { \
+		if (!(cond)) { \
+			std::cout << __FILE__ << ":" << __LINE__ << ": check failed: " #cond << std::endl; \
+			g_failures++; \
+		} \
+	} while (0)
+
+void test_admission();
+void test_reactor();
+void test_channel();
+void test_future();
+void test_taskgraph();
+void test_trace();
+void test_pool();
+void test_blocking();
+void test_replicated();
+void test_partitioned();
+void test_sync();
+void test_cohortlock();
+void test_handoff();
+void test_parallel();
+
+#endif